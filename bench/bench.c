@@ -0,0 +1,446 @@
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <rbtree.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef RBTREE_VARIANT
+#define RBTREE_VARIANT ""
+#endif
+
+// rbtree API 마이크로벤치마크
+// (할당 방식, 분포, 크기, 연산)마다 CSV 한 줄을 출력한다:
+//   variant,alloc,dist,n,op,ops,ns_per_op,mops_per_sec,bytes_per_key
+//
+// 사용법: bench [-n 1000,10000,...] [-d seq,rev,uniform,zipf,dup] [-a malloc,arena] [-t threads]
+// -t를 주면 그 수만큼의 스레드로 rbtree_sharded 삽입/탐색(alloc 열 "sharded")과
+// 1개와 그 수만큼의 스레드로 집합 연산도 측정한다. (RBTREE_TOPDOWN 빌드에는 집합 연산이 없음)
+
+typedef enum { DIST_SEQ, DIST_REV, DIST_UNIFORM, DIST_ZIPF, DIST_DUP } dist_t;
+static const char *dist_names[] = {"seq", "rev", "uniform", "zipf", "dup"};
+#define NUM_DISTS (sizeof(dist_names) / sizeof(dist_names[0]))
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*: 빠르고 key 생성에는 충분한 난수 생성기
+static uint64_t rng(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 치우침 theta의 Zipf 분포로 [0, n) 순위를 만드는 생성기 (Gray et al., SIGMOD '94)
+typedef struct {
+  double theta, alpha, zetan, eta;
+  uint64_t n;
+} zipf_gen;
+
+static void zipf_init(zipf_gen *z, const uint64_t n, const double theta) {
+  double zeta2 = 0;
+  z->zetan = 0;
+  for (uint64_t i = 1; i <= n; i++) {
+    const double v = 1.0 / pow((double)i, theta);
+    z->zetan += v;
+    if (i <= 2) {
+      zeta2 += v;
+    }
+  }
+  z->n = n;
+  z->theta = theta;
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const zipf_gen *z) {
+  const double u = (double)(rng() >> 11) / (double)(1ull << 53);
+  const double uz = u * z->zetan;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, z->theta)) {
+    return 1;
+  }
+  return (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+}
+
+// 생성하는 key는 모두 짝수이므로 key + 1은 항상 없는 key다.
+static key_t *gen_keys(const dist_t dist, const size_t n) {
+  key_t *keys = malloc(n * sizeof(key_t));
+  zipf_gen z = {0};
+  if (dist == DIST_ZIPF) {
+    zipf_init(&z, n, 0.99);
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint64_t v = 0;
+    switch (dist) {
+      case DIST_SEQ:
+        v = i;
+        break;
+      case DIST_REV:
+        v = n - 1 - i;
+        break;
+      case DIST_UNIFORM:
+        v = rng() % (1u << 29);
+        break;
+      case DIST_ZIPF:
+        // 자주 나오는 key가 가장 작은 key에 몰리지 않도록 순위를 흩는다
+        v = (zipf_next(&z) * 2654435761u) % (1u << 29);
+        break;
+      case DIST_DUP:
+        v = rng() % (n / 100 + 1);
+        break;
+    }
+    keys[i] = (key_t)(v * 2);
+  }
+  return keys;
+}
+
+static void shuffle(void *base, const size_t n, const size_t size) {
+  char tmp[64];
+  char *a = base;
+  for (size_t i = n; i > 1; i--) {
+    const size_t j = rng() % i;
+    memcpy(tmp, a + (i - 1) * size, size);
+    memcpy(a + (i - 1) * size, a + j * size, size);
+    memcpy(a + j * size, tmp, size);
+  }
+}
+
+static void report(const char *alloc, const dist_t dist, const size_t n,
+                   const char *op, const size_t ops, const double ns,
+                   const double bytes_per_key) {
+  const double per_op = ops > 0 ? ns / ops : 0;
+  printf("\"%s\",%s,%s,%zu,%s,%zu,%.2f,%.3f,%.1f\n", RBTREE_VARIANT, alloc,
+         dist_names[dist], n, op, ops, per_op, per_op > 0 ? 1e3 / per_op : 0,
+         bytes_per_key);
+  fflush(stdout);
+}
+
+static int key_cmp(const void *a, const void *b) {
+  const key_t x = *(const key_t *)a, y = *(const key_t *)b;
+  return (x > y) - (x < y);
+}
+
+static volatile size_t sink;
+
+// 할당기가 지금 내주고 있는 heap 바이트를 반환하는 함수 (청크 헤더와 정렬 padding 포함, 알 수 없으면 0)
+static size_t heap_bytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  const struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// 트리를 만드느라 늘어난 메모리를 key 하나당 바이트로 반환하는 함수
+// malloc 모드의 노드마다 붙는 할당기 헤더와 padding까지 세도록 heap 사용량의 차이로 잰다.
+// RBTREE_INDEX32의 노드는 malloc 밖의 pool 청크(헤더 없음)에 있으므로 rbtree_memory_usage가 실제 값이다.
+static double measured_bytes_per_key(const rbtree *t, const size_t heap_before, const size_t n) {
+  size_t used = heap_bytes() - heap_before;
+#ifdef RBTREE_INDEX32
+  used = 0;
+#endif
+  if (used == 0)
+    used = rbtree_memory_usage(t);
+  return (double)used / n;
+}
+
+static void bench_one(const int arena, const dist_t dist, const size_t n) {
+  const char *alloc = arena ? "arena" : "malloc";
+  key_t *keys = gen_keys(dist, n);
+  const size_t heap_before = heap_bytes();
+  rbtree *t = arena ? new_rbtree_sized(n) : new_rbtree();
+
+  double start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+  double ns = now_ns() - start;
+  const double bpk = measured_bytes_per_key(t, heap_before, n);
+  report(alloc, dist, n, "insert", n, ns, bpk);
+
+  // 같은 key를 직전에 넣은 노드를 hint로 주며 삽입
+  rbtree *h = arena ? new_rbtree_sized(n) : new_rbtree();
+  node_t *hint = NULL;
+  start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    hint = rbtree_insert_hint(h, hint, keys[i]);
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "insert_hint", n, ns, bpk);
+  delete_rbtree(h);
+
+  // 삽입 순서와 관계없는 순서로 탐색
+  shuffle(keys, n, sizeof(key_t));
+  size_t hits = 0;
+  start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    hits += rbtree_find(t, keys[i]) != NULL;
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "find_hit", n, ns, bpk);
+
+  start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    hits += rbtree_find(t, keys[i] + 1) != NULL;
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "find_miss", n, ns, bpk);
+
+  // 같은 탐색을 16개씩 번갈아 내려가며 수행
+  node_t **found = malloc(n * sizeof(node_t *));
+  start = now_ns();
+  hits += rbtree_find_batch(t, keys, n, found);
+  ns = now_ns() - start;
+  report(alloc, dist, n, "find_batch_hit", n, ns, bpk);
+  free(found);
+
+  const size_t reps = n < 1000000 ? n : 1000000;
+  start = now_ns();
+  for (size_t i = 0; i < reps; i++) {
+    hits += rbtree_min(t)->key < rbtree_max(t)->key;
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "min_max", reps, ns, bpk);
+
+  key_t *out = malloc(n * sizeof(key_t));
+  start = now_ns();
+  rbtree_to_array(t, out, n);
+  ns = now_ns() - start;
+  report(alloc, dist, n, "to_array", n, ns, bpk);
+  hits += out[n / 2];
+
+  // 같은 탐색을 frozen 복사본에서 수행 (8개 key 단위의 Eytzinger 블록)
+  rbtree_frozen *f = rbtree_freeze(rbtree_from_sorted(out, n));
+  start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    hits += rbtree_frozen_find(f, keys[i]);
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "frozen_find_hit", n, ns, (double)((n + 7) / 8 * 8 * sizeof(key_t)) / n);
+  delete_rbtree_frozen(f);
+  free(out);
+
+  // 스냅샷 파일로 저장했다가 다시 읽음 (load는 매핑한 key로 한 번에 트리를 만든다)
+  char path[] = "/tmp/rbtree-bench-XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd >= 0) {
+    close(fd);
+    start = now_ns();
+    rbtree_save(t, path);
+    report(alloc, dist, n, "save", n, now_ns() - start, bpk);
+    start = now_ns();
+    rbtree *loaded = rbtree_load(path);
+    report(alloc, dist, n, "load", n, now_ns() - start, bpk);
+    hits += rbtree_size(loaded);
+    delete_rbtree(loaded);
+    remove(path);
+  }
+
+  // 모든 노드를 무작위 순서로 삭제 (삭제해도 다른 노드 포인터는 그대로 유효)
+  node_t **nodes = malloc(n * sizeof(node_t *));
+  size_t m = 0;
+  rbtree_iter it;
+  rbtree_iter_init(&it, t);
+  for (node_t *p = rbtree_iter_next(&it); p != NULL; p = rbtree_iter_next(&it)) {
+    nodes[m++] = p;
+  }
+  shuffle(nodes, m, sizeof(node_t *));
+  start = now_ns();
+  for (size_t i = 0; i < m; i++) {
+    rbtree_erase(t, nodes[i]);
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "erase", m, ns, bpk);
+
+  // 다시 만든 뒤, 오래된 key부터 100개 구간으로 나누어 만료
+  qsort(keys, n, sizeof(key_t), key_cmp);
+  rbtree *w = rbtree_from_sorted(keys, n);
+  start = now_ns();
+  for (size_t i = 0; i < 100; i++) {
+    const key_t hi = i == 99 ? keys[n - 1] + 1 : keys[(i + 1) * n / 100];
+    hits += rbtree_erase_range(w, keys[i * n / 100], hi);
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "erase_range", n, ns, bpk);
+  delete_rbtree(w);
+
+  // key로 무작위 순서 삭제 (key마다 한 번 내려감, 노드 포인터 없이 엔진끼리 비교)
+  w = rbtree_from_sorted(keys, n);
+  shuffle(keys, n, sizeof(key_t));
+  start = now_ns();
+  for (size_t i = 0; i < n; i++) {
+    hits += rbtree_erase_key(w, keys[i]);
+  }
+  ns = now_ns() - start;
+  report(alloc, dist, n, "erase_key", n, ns, bpk);
+  delete_rbtree(w);
+
+  sink = hits;
+  free(nodes);
+  delete_rbtree(t);
+  free(keys);
+}
+
+typedef struct {
+  rbtree_sharded *s;
+  const key_t *keys;
+  size_t n;
+  int find;
+} shard_job;
+
+static void *shard_worker(void *p) {
+  shard_job *job = p;
+  size_t hits = 0;
+  for (size_t i = 0; i < job->n; i++) {
+    if (job->find)
+      hits += rbtree_sharded_find(job->s, job->keys[i]);
+    else
+      rbtree_sharded_insert(job->s, job->keys[i]);
+  }
+  sink = hits;
+  return NULL;
+}
+
+// key를 스레드 수로 고르게 나누어 삽입 또는 탐색을 한 번 수행하는 함수
+static double shard_pass(rbtree_sharded *s, const key_t *keys, const size_t n,
+                         const int threads, const int find) {
+  pthread_t tid[threads];
+  shard_job jobs[threads];
+  const double start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    const size_t lo = n * i / threads, hi = n * (i + 1) / threads;
+    jobs[i] = (shard_job){s, keys + lo, hi - lo, find};
+    pthread_create(&tid[i], NULL, shard_worker, &jobs[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  return now_ns() - start;
+}
+
+static void bench_sharded(const dist_t dist, const size_t n, const int threads) {
+  key_t *keys = gen_keys(dist, n);
+  rbtree_sharded *s = new_rbtree_sharded(4 * threads);
+  char op[32];
+
+  snprintf(op, sizeof(op), "insert_t%d", threads);
+  report("sharded", dist, n, op, n, shard_pass(s, keys, n, threads, 0), 0);
+  shuffle(keys, n, sizeof(key_t));
+  snprintf(op, sizeof(op), "find_hit_t%d", threads);
+  report("sharded", dist, n, op, n, shard_pass(s, keys, n, threads, 1), 0);
+
+  delete_rbtree_sharded(s);
+  free(keys);
+}
+
+#ifndef RBTREE_TOPDOWN
+// key를 절반씩 나눈 두 트리를 집합 연산마다 합쳐 보는 함수 (ops = 두 트리의 key 수)
+static void bench_setops(const int arena, const dist_t dist, const size_t n, const int threads) {
+  static const char *names[] = {"union", "intersect", "difference"};
+  const char *alloc = arena ? "arena" : "malloc";
+  key_t *keys = gen_keys(dist, n);
+  const int counts[] = {1, threads};
+  for (int c = 0; c < (threads > 1 ? 2 : 1); c++) {
+    for (int op = 0; op < 3; op++) {
+      rbtree *a = arena ? new_rbtree_sized(n / 2) : new_rbtree();
+      rbtree *b = arena ? new_rbtree_sized(n - n / 2) : new_rbtree();
+      for (size_t i = 0; i < n; i++) {
+        rbtree_insert(i < n / 2 ? a : b, keys[i]);
+      }
+      const double start = now_ns();
+      a = op == 0   ? rbtree_union(a, b, counts[c])
+          : op == 1 ? rbtree_intersect(a, b, counts[c])
+                    : rbtree_difference(a, b, counts[c]);
+      const double ns = now_ns() - start;
+      char name[32];
+      snprintf(name, sizeof(name), "%s_t%d", names[op], counts[c]);
+      report(alloc, dist, n, name, n, ns, 0);
+      delete_rbtree(a);
+    }
+  }
+  free(keys);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  char *sizes = strdup("1000,10000,100000,1000000");
+  char *dists = strdup("seq,rev,uniform,zipf,dup");
+  char *allocs = strdup("malloc,arena");
+  int threads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:a:t:")) != -1) {
+    switch (opt) {
+      case 'n':
+        free(sizes);
+        sizes = strdup(optarg);
+        break;
+      case 'd':
+        free(dists);
+        dists = strdup(optarg);
+        break;
+      case 'a':
+        free(allocs);
+        allocs = strdup(optarg);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n sizes] [-d dists] [-a malloc,arena] [-t threads]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("variant,alloc,dist,n,op,ops,ns_per_op,mops_per_sec,bytes_per_key\n");
+  char *save_a, *save_d, *save_n;
+  for (char *a = strtok_r(allocs, ",", &save_a); a != NULL; a = strtok_r(NULL, ",", &save_a)) {
+    const int arena = strcmp(a, "arena") == 0;
+    char *dlist = strdup(dists);
+    for (char *d = strtok_r(dlist, ",", &save_d); d != NULL; d = strtok_r(NULL, ",", &save_d)) {
+      dist_t dist = NUM_DISTS;
+      for (int i = 0; i < NUM_DISTS; i++) {
+        if (strcmp(d, dist_names[i]) == 0) {
+          dist = (dist_t)i;
+        }
+      }
+      if (dist == NUM_DISTS) {
+        fprintf(stderr, "unknown distribution: %s\n", d);
+        return 1;
+      }
+      char *nlist = strdup(sizes);
+      for (char *s = strtok_r(nlist, ",", &save_n); s != NULL; s = strtok_r(NULL, ",", &save_n)) {
+        const size_t n = strtoull(s, NULL, 10);
+        if (n > 0) {
+          bench_one(arena, dist, n);
+          if (threads > 0 && !arena)
+            bench_sharded(dist, n, threads);
+#ifndef RBTREE_TOPDOWN
+          if (threads > 0)
+            bench_setops(arena, dist, n, threads);
+#endif
+        }
+      }
+      free(nlist);
+    }
+    free(dlist);
+  }
+
+  free(allocs);
+  free(dists);
+  free(sizes);
+  return 0;
+}
@@ -1,338 +1,3829 @@
 #include "rbtree.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 노드 링크 접근자 (노드 레이아웃은 rbtree.h 참고)
+#define LEFT(x) rbtree_left(x)
+#define RIGHT(x) rbtree_right(x)
+#define PARENT(x) rbtree_parent(x)
+#define COLOR(x) rbtree_color(x)
+#define SET_LEFT(x, c) rbtree_set_left(x, c)
+#define SET_RIGHT(x, c) rbtree_set_right(x, c)
+#define SET_PARENT(x, p) rbtree_set_parent(x, p)
+#define SET_COLOR(x, c) rbtree_set_color(x, c)
+#define COPIES(x) rbtree_copies(x)
+
+// 내부 동작 카운터 (RBTREE_STATS가 없으면 아무 코드도 만들지 않는다)
+#ifdef RBTREE_STATS
+#define STAT_INC(t, field) ((t)->stats->field++)
+#define STAT_DESCENT_BEGIN(t) const size_t stat_cmp0 = (t)->stats->comparisons
+#define STAT_DESCENT_END(t) stat_depth(t, (t)->stats->comparisons - stat_cmp0)
+
+static void stat_depth(const rbtree *t, size_t depth) {
+  if (depth >= RBTREE_STATS_DEPTHS)
+    depth = RBTREE_STATS_DEPTHS - 1;
+  t->stats->depth_hist[depth]++;
+}
+#else
+#define STAT_INC(t, field) ((void)0)
+#define STAT_DESCENT_BEGIN(t)
+#define STAT_DESCENT_END(t) ((void)0)
+#endif
+
+// 부모 포인터가 없는 트리인지 (copy-on-write 트리와 RBTREE_TOPDOWN 빌드의 모든 트리)
+#ifdef RBTREE_TOPDOWN
+#define NO_PARENT(t) 1
+#else
+#define NO_PARENT(t) ((t)->cow != NULL)
+#endif
+
+// 읽기 함수가 루트를 읽는 접근자
+// copy-on-write 트리의 reader는 잠그지 않으므로, writer가 release로 바꾼 새 루트를 따라갈 때
+// 복사된 노드의 내용도 보이도록 acquire로 읽는다 (x86에서는 일반 load와 같다).
+#define ROOT(t) __atomic_load_n(&(t)->root, __ATOMIC_ACQUIRE)
+
+// fixup에서 색을 칠하는 접근자 (recolors 카운터 포함)
+#define RECOLOR(t, x, c) (STAT_INC(t, recolors), SET_COLOR(x, c))
 
 void rbtree_insert_fixup(rbtree *t,node_t *z);
 void rbtree_transplant(rbtree *t, node_t *u, node_t *v);
-node_t *rbtree_successor(rbtree *t, node_t *x);
+node_t *subtree_min(const rbtree *t, node_t *x);
+node_t *subtree_max(const rbtree *t, node_t *x);
 node_t *rbtree_find(const rbtree *t, const key_t key);
-void rbtree_erase_fixup(rbtree *t, node_t *x);
+void rbtree_erase_fixup(rbtree *t, node_t *x, node_t *xp);
 void delete_node(rbtree *t, node_t *node);
-int inorder(node_t *x, const rbtree *t, key_t *arr, int i);
 void left_rotate(rbtree *t, node_t *x);
 void right_rotate(rbtree *t, node_t *x);
+#ifdef RBTREE_TOPDOWN
+static node_t *td_insert(rbtree *t, const key_t key, const int unique, int *inserted);
+static int td_remove(rbtree *t, const key_t key, node_t *target);
+static int td_path(const rbtree *t, node_t *x, const node_t *z, node_t **path, int d);
+#else
+static void detach_node(rbtree *t, node_t *z);
+static size_t free_subtree(rbtree *t, node_t *x);
+#endif
+static node_t *subtree_find(const rbtree *t, node_t *x, const key_t key);
+static node_t *cow_insert(rbtree *t, const key_t key, const int unique, int *inserted);
+static int cow_erase(rbtree *t, node_t *z);
+static size_t cow_to_array(const rbtree *t, key_t *arr, const size_t n);
+static void cow_free(rbtree *t);
+node_t *node_alloc(rbtree *t);
+void node_free(rbtree *t, node_t *node);
+
+/* 0. 노드 슬랩(arena) 할당기 */
+// 노드를 큰 청크 단위로 잘라 쓰고, 삭제된 노드는 free list로 재사용한다.
+#define ARENA_MIN_CHUNK 64
+#define ARENA_MAX_CHUNK (1 << 16)
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t cap;
+  node_t nodes[];  // 실제 간격은 t->node_size (맵 트리는 값 공간만큼 더 넓다)
+} arena_chunk;
+
+struct rbtree_arena {
+  arena_chunk *chunks;  // 할당받은 청크 목록 (가장 최근 청크가 맨 앞)
+  node_t *free_list;    // 삭제된 노드 목록 (left 포인터로 연결)
+  size_t used;          // 가장 최근 청크에서 사용한 노드 수
+  size_t next_cap;      // 다음에 할당할 청크의 노드 수
+  int zeroed;           // 새 청크를 0으로 채워서 할당 (동시 읽기용 트리)
+  size_t refs;          // 이 arena를 쓰는 트리 수 (rbtree_split으로 나뉜 트리는 arena를 공유한다)
+};
+
+#ifdef RBTREE_INDEX32
+// 32비트 인덱스 모드: 모든 트리의 노드는 미리 예약한 하나의 영역(pool)에 있고
+// 16바이트 단위 오프셋으로 가리킨다. 오프셋 0은 모든 트리가 공유하는 nil 노드이다.
+#ifndef RBTREE_POOL_RESERVE
+#define RBTREE_POOL_RESERVE ((size_t)1 << 35)  // 31비트 인덱스 x 16바이트
+#endif
+#define POOL_CHUNK_BYTES ((size_t)1 << 20)
+
+char *rbtree_pool_base;
+static size_t pool_top;                // 아직 잘라 주지 않은 영역의 시작 오프셋
+static arena_chunk *pool_free_chunks;  // 삭제된 트리가 돌려준 청크 목록
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// pool 영역을 예약하고 nil 노드를 만드는 함수 (처음 한 번만, pool_lock 안에서 호출)
+static int pool_init(void) {
+  if (rbtree_pool_base != NULL)
+    return 0;
+  void *base = mmap(NULL, RBTREE_POOL_RESERVE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    return -1;
+  rbtree_pool_base = (char *)base;
+  ((node_t *)base)->parent_color = RBTREE_BLACK;  // nil: 부모/자식 모두 0, 검정
+  // nil 노드 전체(순서 통계 빌드에서는 16바이트보다 크다) 뒤부터 청크를 잘라 준다
+  pool_top = (sizeof(node_t) + RBTREE_NODE_ALIGN - 1) / RBTREE_NODE_ALIGN * RBTREE_NODE_ALIGN;
+  return 0;
+}
+
+// 고정 크기(POOL_CHUNK_BYTES) 청크를 pool에서 잘라 주는 함수
+static arena_chunk *pool_chunk_alloc(void) {
+  arena_chunk *c = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (pool_free_chunks != NULL) {
+    c = pool_free_chunks;
+    pool_free_chunks = c->next;
+  } else if (pool_top + POOL_CHUNK_BYTES <= RBTREE_POOL_RESERVE) {
+    c = (arena_chunk *)(rbtree_pool_base + pool_top);
+    pool_top += POOL_CHUNK_BYTES;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return c;
+}
+
+static void pool_chunk_release(arena_chunk *c) {
+  pthread_mutex_lock(&pool_lock);
+  c->next = pool_free_chunks;
+  pool_free_chunks = c;
+  pthread_mutex_unlock(&pool_lock);
+}
+#else
+// 포인터 모드에서는 모든 트리가 읽기 전용 nil 노드 하나를 공유한다.
+#ifdef RBTREE_COMPACT
+static node_t nil_node = {.parent_color = RBTREE_BLACK};
+#else
+static node_t nil_node = {.color = RBTREE_BLACK};
+#endif
+#endif
+
+// 노드 cap개 이상을 담을 청크를 할당하는 함수 (실제 개수는 c->cap)
+static arena_chunk *chunk_alloc(const rbtree *t, size_t cap) {
+#ifdef RBTREE_INDEX32
+  arena_chunk *c = pool_chunk_alloc();
+  if (c != NULL)
+    c->cap = (POOL_CHUNK_BYTES - sizeof(arena_chunk)) / t->node_size;
+#else
+  const size_t bytes = sizeof(arena_chunk) + cap * t->node_size;
+  arena_chunk *c = (arena_chunk *)(t->arena->zeroed ? calloc(1, bytes) : malloc(bytes));
+  if (c != NULL)
+    c->cap = cap;
+#endif
+  return c;
+}
+
+static void chunk_release(arena_chunk *c) {
+#ifdef RBTREE_INDEX32
+  pool_chunk_release(c);
+#else
+  free(c);
+#endif
+}
+
+// 트리에 노드 하나를 할당하는 함수 (arena가 없으면 malloc)
+node_t *node_alloc(rbtree *t) {
+  rbtree_arena *a = t->arena;
+  STAT_INC(t, allocs);
+  if (a == NULL)
+    return (node_t *)malloc(t->node_size);
+
+  if (a->free_list != NULL) {
+    node_t *node = a->free_list;
+    node_t *next = LEFT(node);
+    a->free_list = next == t->nil ? NULL : next;
+    return node;
+  }
+
+  if (a->chunks == NULL || a->used == a->chunks->cap) {
+    size_t cap = a->next_cap;
+    arena_chunk *c = chunk_alloc(t, cap);
+    if (c == NULL)
+      return NULL;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->used = 0;
+    a->next_cap = cap * 2 < ARENA_MAX_CHUNK ? cap * 2 : ARENA_MAX_CHUNK;
+  }
+  return (node_t *)((char *)a->chunks->nodes + t->node_size * a->used++);
+}
+
+// 노드 하나를 반환하는 함수 (arena가 있으면 free list에 보관)
+void node_free(rbtree *t, node_t *node) {
+  rbtree_arena *a = t->arena;
+  STAT_INC(t, frees);
+  if (a == NULL) {
+    free(node);
+    return;
+  }
+  SET_LEFT(node, a->free_list == NULL ? t->nil : a->free_list);
+  a->free_list = node;
+}
+
+#ifndef RBTREE_TOPDOWN
+// 새로 연결된 노드 x만큼 트리 크기와 조상들의 서브트리 크기를 늘리는 함수
+static void size_attach(rbtree *t, node_t *x) {
+  t->count++;
+#ifdef RBTREE_ORDER_STAT
+  x->size = 1;
+  for (node_t *p = PARENT(x); p != t->nil; p = PARENT(p))
+    p->size++;
+#endif
+}
+
+// 트리에서 빠질 노드 z만큼 트리 크기와 조상들의 서브트리 크기를 줄이는 함수
+// x는 실제로 자리에서 빠지는 노드(z 또는 z 자리로 옮겨 갈 후속 노드)로, z 아래의 조상은 x의 개수만큼 줄어든다.
+static void size_detach(rbtree *t, node_t *x, node_t *z) {
+  t->count -= COPIES(z);
+#ifdef RBTREE_ORDER_STAT
+  node_t *p = PARENT(x);
+  for (; p != z && p != t->nil; p = PARENT(p))
+    p->size -= COPIES(x);
+  for (; p != t->nil; p = PARENT(p))
+    p->size -= COPIES(z);
+#endif
+}
+#endif
+
+#ifdef RBTREE_COUNTED
+// 노드 x가 가진 같은 key의 개수를 d만큼 바꾸고 트리 크기와 서브트리 크기에 반영하는 함수
+static void copies_change(rbtree *t, node_t *x, const long d) {
+  x->copies += d;
+  t->count += d;
+#ifdef RBTREE_ORDER_STAT
+  for (node_t *p = x; p != t->nil; p = PARENT(p))
+    p->size += d;
+#endif
+}
+#endif
+
+// 자식이 없는 빨간 새 노드를 만드는 함수
+static node_t *new_node(rbtree *t, const key_t key) {
+  node_t *z = node_alloc(t);
+  if (z == NULL)
+    return NULL;
+  z->key = key;
+  SET_LEFT(z, t->nil);
+  SET_RIGHT(z, t->nil);
+  SET_COLOR(z, RBTREE_RED);
+  return z;
+}
 
+#ifndef RBTREE_TOPDOWN
+// 탐색으로 찾은 자리(parent의 자식)에 새 노드 z를 연결하고 균형을 복구하는 함수
+static void attach_node(rbtree *t, node_t *parent, node_t *z) {
+  SET_PARENT(z, parent);
+  if (parent == t->nil)
+    t->root = z;
+  else if (z->key < parent->key)
+    SET_LEFT(parent, z);
+  else
+    SET_RIGHT(parent, z);
+#ifdef RBTREE_COUNTED
+  z->copies = 1;
+#endif
+  size_attach(t, z);
+  // 알고 있던 최대 노드의 오른쪽에 붙었으면 새 노드가 최대 노드다 (회전은 최대 노드를 바꾸지 않음)
+  if (parent != t->nil && parent == t->rightmost && z == RIGHT(parent))
+    t->rightmost = z;
+  rbtree_insert_fixup(t, z);
+}
+#endif
 
 /* 1. RB tree 구조체 생성 */
 // 트리를 생성하는 함수
 rbtree *new_rbtree(void) {
   rbtree *t = (rbtree *)calloc(1, sizeof(rbtree));
-  node_t *nil_node = (node_t *)calloc(1,sizeof(node_t));
-  nil_node->color = RBTREE_BLACK;
+  if (t == NULL)
+    return NULL;
+  t->node_size = (sizeof(node_t) + RBTREE_NODE_ALIGN - 1) / RBTREE_NODE_ALIGN * RBTREE_NODE_ALIGN;
+
+#ifdef RBTREE_INDEX32
+  // 인덱스 모드의 노드는 항상 pool의 arena 청크에서 할당
+  pthread_mutex_lock(&pool_lock);
+  int err = pool_init();
+  pthread_mutex_unlock(&pool_lock);
+  if (err != 0) {
+    free(t);
+    return NULL;
+  }
+  t->nil = RBTREE_PTR(0);
+  t->arena = (rbtree_arena *)calloc(1, sizeof(rbtree_arena));
+  if (t->arena == NULL) {
+    free(t);
+    return NULL;
+  }
+  t->arena->next_cap = ARENA_MIN_CHUNK;
+  t->arena->refs = 1;
+#else
+  t->nil = &nil_node;
+#endif
+#ifdef RBTREE_STATS
+  t->stats = (rbtree_stats *)calloc(1, sizeof(rbtree_stats));
+  if (t->stats == NULL) {
+    free(t->arena);
+    free(t);
+    return NULL;
+  }
+#endif
+  t->root = t->nil; 
+  return t;
+}
 
-  t->nil = nil_node; 
-  t->root = nil_node; 
+// 예상 노드 수(hint)만큼의 첫 청크를 가진 arena 기반 트리를 생성하는 함수
+// (인덱스 모드의 청크 크기는 고정이므로 hint를 쓰지 않는다)
+rbtree *new_rbtree_sized(const size_t hint) {
+  rbtree *t = new_rbtree();
+  if (t == NULL)
+    return NULL;
+  if (t->arena == NULL)
+    t->arena = (rbtree_arena *)calloc(1, sizeof(rbtree_arena));
+  if (t->arena == NULL) {
+    delete_rbtree(t);
+    return NULL;
+  }
+  t->arena->next_cap = hint > ARENA_MIN_CHUNK ? hint : ARENA_MIN_CHUNK;
+  t->arena->refs = 1;
   return t;
 }
 
 /* 2. RB tree 구조체가 차지했던 메모리 반환 */
 // 트리와 노드의 메모리를 해제하는 함수
 void delete_node(rbtree *t, node_t *node){
-  if(node->left != t->nil)
-    delete_node(t, node->left); 
-  if(node->right != t->nil)
-    delete_node(t, node->right); 
+  if(LEFT(node) != t->nil)
+    delete_node(t, LEFT(node)); 
+  if(RIGHT(node) != t->nil)
+    delete_node(t, RIGHT(node)); 
   free(node);
 }
 
 // 트리를 삭제 시 순회하면서 각 노드의 메모리를 반환하는 함수
 void delete_rbtree(rbtree *t) {
+  if (t->cow != NULL)
+    cow_free(t);
+
+  // arena 기반 트리는 노드를 하나씩 순회하지 않고 청크 단위로 해제
+  // (arena를 함께 쓰는 트리가 남아 있으면 마지막 트리가 삭제될 때 해제)
+  if (t->arena != NULL) {
+    arena_chunk *c = --t->arena->refs > 0 ? NULL : t->arena->chunks;
+    while (c != NULL) {
+      arena_chunk *next = c->next;
+      chunk_release(c);
+      c = next;
+    }
+    if (t->arena->refs == 0)
+      free(t->arena);
+#ifdef RBTREE_STATS
+    free(t->stats);
+#endif
+    free(t);
+    return;
+  }
+
+  // intrusive 트리의 노드는 호출한 쪽의 메모리이므로 해제하지 않음
   node_t *node = t->root;
-  if(node != t->nil)
+  if(node != t->nil && !t->intrusive)
     delete_node(t,node);
-  free(t->nil);
+#ifdef RBTREE_STATS
+  free(t->stats);
+#endif
   free(t);
 }
 
+// 트리가 노드 저장에 쓰고 있는 메모리(바이트)를 반환하는 함수
+// arena 트리는 할당받은 청크 전체, 그 외에는 노드 수 x 노드 크기
+size_t rbtree_memory_usage(const rbtree *t) {
+  size_t bytes = sizeof(rbtree);
+  if (t->arena == NULL) {
+    size_t nodes = t->count;
+#ifdef RBTREE_COUNTED
+    // 노드 하나가 같은 key 여러 개를 가지므로 노드 수는 순회해서 센다
+    rbtree_iter it;
+    rbtree_iter_init(&it, t);
+    for (nodes = 0; rbtree_iter_next(&it) != NULL; nodes++)
+      ;
+#endif
+    return bytes + (t->intrusive ? 0 : nodes * t->node_size);
+  }
+
+  bytes += sizeof(rbtree_arena);
+  for (arena_chunk *c = t->arena->chunks; c != NULL; c = c->next)
+    bytes += sizeof(arena_chunk) + c->cap * t->node_size;
+  return bytes;
+}
+
 /* 3. key 추가 */
 // 새로운 키를 RB 트리에 추가하는 함수
 node_t *rbtree_insert(rbtree *t, const key_t key) {
-  node_t *addnode = (node_t *)malloc(sizeof(node_t));
-  addnode->key = key;
-  addnode->left = t->nil;
-  addnode->right = t->nil;
-  addnode->color = RBTREE_RED;
-
+  // intrusive 트리는 노드를 할당하지 않으므로 rbtree_link로만 추가한다 (여기서 만든 노드는 해제할 곳이 없다)
+  if (t->intrusive)
+    return NULL;
+  if (t->cow != NULL) {
+    int inserted;
+    return cow_insert(t, key, 0, &inserted);
+  }
+#ifdef RBTREE_TOPDOWN
+  int inserted;
+  return td_insert(t, key, 0, &inserted);
+#else
   node_t *cur = t->root; 
   node_t *parent = t->nil; 
 
+  STAT_DESCENT_BEGIN(t);
   while (cur != t->nil) {
+    STAT_INC(t, comparisons);
+#ifdef RBTREE_COUNTED
+    // 같은 key의 노드가 있으면 새 노드 대신 그 노드의 개수를 늘린다 (가득 찬 노드는 건너뜀)
+    if (cur->key == key && cur->copies < RBTREE_MAX_COPIES)
+      break;
+#endif
     parent = cur;
     if (cur->key > key) {
-      cur = cur->left;
+      cur = LEFT(cur);
     } else {
-      cur = cur->right;
+      cur = RIGHT(cur);
     }
   }
+  STAT_DESCENT_END(t);
+#ifdef RBTREE_COUNTED
+  if (cur != t->nil) {
+    copies_change(t, cur, 1);
+    return cur;
+  }
+#endif
 
-  addnode->parent = parent; 
+  node_t *addnode = new_node(t, key);
+  if (addnode == NULL)
+    return NULL;
+  attach_node(t, parent, addnode);
+  return addnode;
+#endif
+}
 
-  if (parent == t->nil) {
-    t->root = addnode;
-  } else if (key < parent->key) {
-    parent->left = addnode;
-  } else {
-    parent->right = addnode;
+// key가 없을 때만 추가하는 함수 (한 번만 내려가며, 이미 있으면 그 노드를 그대로 반환)
+// *inserted(NULL 가능)에는 새 노드를 추가했으면 1, 기존 노드를 반환했으면 0을 기록한다.
+node_t *rbtree_insert_unique(rbtree *t, const key_t key, int *inserted) {
+  int dummy;
+  if (inserted == NULL)
+    inserted = &dummy;
+  *inserted = 0;
+  if (t->intrusive)
+    return NULL;
+  if (t->cow != NULL)
+    return cow_insert(t, key, 1, inserted);
+#ifdef RBTREE_TOPDOWN
+  return td_insert(t, key, 1, inserted);
+#else
+  node_t *cur = t->root;
+  node_t *parent = t->nil;
+  STAT_DESCENT_BEGIN(t);
+  while (cur != t->nil) {
+    STAT_INC(t, comparisons);
+    if (cur->key == key)
+      break;
+    parent = cur;
+    cur = cur->key > key ? LEFT(cur) : RIGHT(cur);
   }
+  STAT_DESCENT_END(t);
+  if (cur != t->nil)
+    return cur;
 
-  rbtree_insert_fixup(t,addnode);
+  node_t *addnode = new_node(t, key);
+  if (addnode == NULL)
+    return NULL;
+  attach_node(t, parent, addnode);
+  *inserted = 1;
   return addnode;
+#endif
 }
 
+#ifndef RBTREE_TOPDOWN
 // 새로운 노드 삽입 후 발생한 불균형을 복구하는 함수
 void rbtree_insert_fixup(rbtree *t,node_t *z) {
-  while(z != t->root && z->parent->color == RBTREE_RED) {
-    if(z->parent->parent->left == z->parent) {
-      node_t *y = z->parent->parent->right;
-      if(y->color == RBTREE_RED) {
-        z->parent->color = RBTREE_BLACK;
-        y->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        z = z->parent->parent;
+  while(z != t->root && COLOR(PARENT(z)) == RBTREE_RED) {
+    STAT_INC(t, insert_fixups);
+    if(LEFT(PARENT(PARENT(z))) == PARENT(z)) {
+      node_t *y = RIGHT(PARENT(PARENT(z)));
+      if(COLOR(y) == RBTREE_RED) {
+        RECOLOR(t, PARENT(z), RBTREE_BLACK);
+        RECOLOR(t, y, RBTREE_BLACK);
+        RECOLOR(t, PARENT(PARENT(z)), RBTREE_RED);
+        z = PARENT(PARENT(z));
       } else {
-        if(z == z->parent->right) {
-          z = z->parent;
+        if(z == RIGHT(PARENT(z))) {
+          z = PARENT(z);
           left_rotate(t,z);
         }
-        z->parent->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        right_rotate(t,z->parent->parent);
+        RECOLOR(t, PARENT(z), RBTREE_BLACK);
+        RECOLOR(t, PARENT(PARENT(z)), RBTREE_RED);
+        right_rotate(t,PARENT(PARENT(z)));
       }
     } else {
-      node_t *y = z->parent->parent->left;
-      if(y->color == RBTREE_RED) {
-        z->parent->color = RBTREE_BLACK;
-        y->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        z = z->parent->parent;
+      node_t *y = LEFT(PARENT(PARENT(z)));
+      if(COLOR(y) == RBTREE_RED) {
+        RECOLOR(t, PARENT(z), RBTREE_BLACK);
+        RECOLOR(t, y, RBTREE_BLACK);
+        RECOLOR(t, PARENT(PARENT(z)), RBTREE_RED);
+        z = PARENT(PARENT(z));
       } else {
-        if(z == z->parent->left) {
-          z = z->parent;
+        if(z == LEFT(PARENT(z))) {
+          z = PARENT(z);
           right_rotate(t,z);
         }
-        z->parent->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        left_rotate(t,z->parent->parent);
+        RECOLOR(t, PARENT(z), RBTREE_BLACK);
+        RECOLOR(t, PARENT(PARENT(z)), RBTREE_RED);
+        left_rotate(t,PARENT(PARENT(z)));
       }
     }
   }
-  t->root->color = RBTREE_BLACK;
+  RECOLOR(t, t->root, RBTREE_BLACK);
 }
 
 // 왼쪽으로 회전하는 함수
 void left_rotate(rbtree *t, node_t *x) {
-  node_t *y = x->right; 
-  x->right = y->left; 
+  STAT_INC(t, rotations);
+  node_t *y = RIGHT(x); 
+  SET_RIGHT(x, LEFT(y)); 
 
-  if (y->left != t->nil) {
-    y->left->parent = x;
+  if (LEFT(y) != t->nil) {
+    SET_PARENT(LEFT(y), x);
   }
 
-  y->parent = x->parent;
+  SET_PARENT(y, PARENT(x));
 
-  if(x->parent == t->nil)
+  if(PARENT(x) == t->nil)
     t->root = y;
 
-  else if (x == x->parent->left)
-    x->parent->left = y;
+  else if (x == LEFT(PARENT(x)))
+    SET_LEFT(PARENT(x), y);
   
   else 
-    x->parent->right = y;
+    SET_RIGHT(PARENT(x), y);
 
-  y->left = x;
+  SET_LEFT(y, x);
 
-  x->parent = y;
+  SET_PARENT(x, y);
+#ifdef RBTREE_ORDER_STAT
+  y->size = x->size;
+  x->size = LEFT(x)->size + RIGHT(x)->size + COPIES(x);
+#endif
 }
 
 
 // 오른쪽으로 회전하는 함수 (left_rotate와 대칭)
 void right_rotate(rbtree *t, node_t *x) {
-  node_t *y = x->left;
-  x->left = y->right;
-  if (y->right != t->nil) {
-    y->right->parent = x;
+  STAT_INC(t, rotations);
+  node_t *y = LEFT(x);
+  SET_LEFT(x, RIGHT(y));
+  if (RIGHT(y) != t->nil) {
+    SET_PARENT(RIGHT(y), x);
   }
-  y->parent = x->parent;
-  if(x->parent == t->nil)
+  SET_PARENT(y, PARENT(x));
+  if(PARENT(x) == t->nil)
     t->root = y;
-  else if (x == x->parent->right)
-    x->parent->right = y;
-  else x->parent->left = y;
-  y->right = x;
-  x->parent = y;
+  else if (x == RIGHT(PARENT(x)))
+    SET_RIGHT(PARENT(x), y);
+  else SET_LEFT(PARENT(x), y);
+  SET_RIGHT(y, x);
+  SET_PARENT(x, y);
+#ifdef RBTREE_ORDER_STAT
+  y->size = x->size;
+  x->size = LEFT(x)->size + RIGHT(x)->size + COPIES(x);
+#endif
 }
+#endif
 
 /* 4. key 탐색 */
 // 4-1. 주어진 키 값에 해당하는 노드를 탐색하여 반환하는 함수
 node_t *rbtree_find(const rbtree *t, const key_t key) {
-  node_t *p = t->root; // 루트 노드부터 탐색 시작
+  node_t *p = ROOT(t); // 루트 노드부터 탐색 시작
 
+  STAT_DESCENT_BEGIN(t);
   while(p != t->nil) {
+    STAT_INC(t, comparisons);
     if(p->key == key)
-      return p; 
+      break; 
     else if(p->key > key)
-      p = p->left; 
+      p = LEFT(p); 
     else 
-      p = p-> right; 
+      p = RIGHT(p); 
   }
+  STAT_DESCENT_END(t);
+
+  return p == t->nil ? NULL : p; 
+}
 
-  return NULL; 
+// 4-2. x를 루트로 하는 서브트리에서 최소값/최대값을 가진 노드를 반환하는 함수
+node_t *subtree_min(const rbtree *t, node_t *x) {
+    while(LEFT(x) != t->nil) {
+      x = LEFT(x);
+    }
+    return x; 
 }
 
-// 4-2. 주어진 노드의 다음 노드를 반환하는 함수 (후계자 찾기)
-node_t *rbtree_successor(rbtree *t, node_t *x) {
-    while(x->left != t->nil) {
-      x = x->left;
+node_t *subtree_max(const rbtree *t, node_t *x) {
+    while(RIGHT(x) != t->nil) {
+      x = RIGHT(x);
     }
     return x; 
 }
 
-// 4-3. 트리에서 최소값을 가진 노드를 탐색하여 반환하는 함수
+// 4-3. 트리에서 최소값을 가진 노드를 탐색하여 반환하는 함수 (빈 트리면 NULL)
 node_t *rbtree_min(const rbtree *t) {
-  node_t* x = t->root; 
+  node_t *root = ROOT(t);
+  if (root == t->nil)
+    return NULL;
+  return subtree_min(t, root);
+}
+
+// 4-4. 트리에서 최대값을 가진 노드를 탐색하여 반환하는 함수 (빈 트리면 NULL)
+node_t *rbtree_max(const rbtree *t) {
+  node_t *root = ROOT(t);
+  if (root == t->nil)
+    return NULL;
+  return subtree_max(t, root);
+}
+
+// 4-5. 중위 순회 기준 다음 노드를 반환하는 함수 (마지막 노드면 NULL)
+// 부모 포인터를 따라 올라가므로 전체 순회 시 한 단계는 amortized O(1)
+node_t *rbtree_next(const rbtree *t, const node_t *x) {
+  if (RIGHT(x) != t->nil)
+    return subtree_min(t, RIGHT(x));
 
-  while(x->left != t->nil) {
-    x = x->left; 
+#ifdef RBTREE_TOPDOWN
+  // 부모 포인터가 없으므로 루트에서 x까지의 경로를 다시 찾아 x가 왼쪽 서브트리에 있는 가장 가까운 조상을 고른다
+  node_t *path[RBTREE_ITER_DEPTH];
+  int d = td_path(t, t->root, x, path, 0);
+  while (d > 0 && path[d] == RIGHT(path[d - 1]))
+    d--;
+  return d > 0 ? path[d - 1] : NULL;
+#else
+  node_t *p = PARENT(x);
+  while (p != t->nil && x == RIGHT(p)) {
+    x = p;
+    p = PARENT(p);
   }
-  return x; 
+  return p == t->nil ? NULL : p;
+#endif
 }
 
-// 4-4. 트리에서 최대값을 가진 노드를 탐색하여 반환하는 함수
-node_t *rbtree_max(const rbtree *t) {
-  node_t* x = t->root; 
+// 4-6. 중위 순회 기준 이전 노드를 반환하는 함수 (rbtree_next와 대칭)
+node_t *rbtree_prev(const rbtree *t, const node_t *x) {
+  if (LEFT(x) != t->nil)
+    return subtree_max(t, LEFT(x));
 
-  while(x->right != t->nil) {
-    x = x->right; 
+#ifdef RBTREE_TOPDOWN
+  node_t *path[RBTREE_ITER_DEPTH];
+  int d = td_path(t, t->root, x, path, 0);
+  while (d > 0 && path[d] == LEFT(path[d - 1]))
+    d--;
+  return d > 0 ? path[d - 1] : NULL;
+#else
+  node_t *p = PARENT(x);
+  while (p != t->nil && x == LEFT(p)) {
+    x = p;
+    p = PARENT(p);
   }
-  return x;
+  return p == t->nil ? NULL : p;
+#endif
+}
+
+// 4-7. keys[i]의 노드를 out[i]에 저장하고(없으면 NULL) 찾은 개수를 반환하는 함수
+// FIND_BATCH개의 탐색을 한 단계씩 번갈아 진행하며, 다음에 읽을 자식을 미리 prefetch한다.
+// 한 탐색이 메모리를 기다리는 동안 나머지 탐색의 load가 함께 진행되므로
+// 캐시에 들어가지 않는 큰 트리에서 rbtree_find를 반복하는 것보다 처리량이 높다.
+#define FIND_BATCH 16
+
+size_t rbtree_find_batch(const rbtree *t, const key_t *keys, const size_t n, node_t **out) {
+  size_t found = 0;
+  for (size_t base = 0; base < n; base += FIND_BATCH) {
+    const size_t m = n - base < FIND_BATCH ? n - base : FIND_BATCH;
+    const key_t *k = keys + base;
+    node_t *cur[FIND_BATCH];
+#ifdef RBTREE_STATS
+    size_t depth[FIND_BATCH] = {0};
+#endif
+    node_t *root = ROOT(t);
+    for (size_t i = 0; i < m; i++)
+      cur[i] = root;
+
+    // live의 i번째 비트: 아직 끝나지 않은 탐색
+    for (unsigned live = (1u << m) - 1; live != 0;) {
+      for (size_t i = 0; i < m; i++) {
+        node_t *p = cur[i];
+        if (!(live >> i & 1))
+          continue;
+        if (p == t->nil) {
+          live &= ~(1u << i);
+          continue;
+        }
+        STAT_INC(t, comparisons);
+#ifdef RBTREE_STATS
+        depth[i]++;
+#endif
+        if (p->key == k[i]) {
+          live &= ~(1u << i);
+          continue;
+        }
+        p = p->key > k[i] ? LEFT(p) : RIGHT(p);
+        __builtin_prefetch(p);
+        cur[i] = p;
+      }
+    }
+
+    for (size_t i = 0; i < m; i++) {
+#ifdef RBTREE_STATS
+      stat_depth(t, depth[i]);
+#endif
+      out[base + i] = cur[i] == t->nil ? NULL : cur[i];
+      found += cur[i] != t->nil;
+    }
+  }
+  return found;
 }
 
 /* 5. 노드 삭제 */
 // 노드를 삭제하는 함수
 int rbtree_erase(rbtree *t, node_t *z) {
+  if (t->cow != NULL)
+    return cow_erase(t, z);
+
+#ifdef RBTREE_COUNTED
+  // 같은 key가 여러 개 있는 노드는 개수만 줄인다
+  if (z->copies > 1) {
+    copies_change(t, z, -1);
+    return 0;
+  }
+#endif
+#ifdef RBTREE_TOPDOWN
+  td_remove(t, z->key, z);
+#else
+  detach_node(t, z);
+  // intrusive 트리의 노드는 호출한 쪽 메모리이므로 떼어내기만 한다 (rbtree_unlink와 같음)
+  if (!t->intrusive)
+    node_free(t, z);
+#endif
+  return 0; 
+}
+
+// key를 가진 노드를 하나 삭제하는 함수 (삭제했으면 1, key가 없으면 0)
+// 찾는 한 번의 하강 뒤에는 부모 포인터로 균형을 복구하므로 rbtree_find를 따로 부를 필요가 없다.
+// (RBTREE_TOPDOWN 빌드는 내려가면서 균형을 맞추고 그 하강 한 번으로 삭제까지 끝낸다)
+int rbtree_erase_key(rbtree *t, const key_t key) {
+#ifdef RBTREE_TOPDOWN
+  if (t->cow == NULL)
+    return td_remove(t, key, NULL);
+#endif
+  node_t *z = subtree_find(t, t->root, key);
+  if (z == NULL)
+    return 0;
+  return rbtree_erase(t, z) == 0;  // copy-on-write 트리는 경로 복사에 실패할 수 있다
+}
+
+#ifndef RBTREE_TOPDOWN
+// 노드 z를 트리에서 떼어내고 균형을 복구하는 함수 (z의 메모리는 반환하지 않음)
+static void detach_node(rbtree *t, node_t *z) {
+  if (z == t->rightmost)
+    t->rightmost = NULL;
   node_t* y = z; 
-  color_t y_original_color = y->color; 
-  node_t *x; 
+  color_t y_original_color = COLOR(y); 
+  node_t *x, *xp;  // x가 nil일 수 있으므로 x의 부모는 xp로 따로 기억
   
-  if (z->left == t->nil) {
-    x = z->right; 
-    rbtree_transplant(t, z, z->right); 
+  if (LEFT(z) == t->nil) {
+    size_detach(t, z, z);
+    x = RIGHT(z); 
+    xp = PARENT(z);
+    rbtree_transplant(t, z, RIGHT(z)); 
 
-  } else if (z->right == t->nil) {
-    x = z->left; 
-    rbtree_transplant(t, z, z->left); 
+  } else if (RIGHT(z) == t->nil) {
+    size_detach(t, z, z);
+    x = LEFT(z); 
+    xp = PARENT(z);
+    rbtree_transplant(t, z, LEFT(z)); 
   } else {
-    y = rbtree_successor(t, z->right); 
-    y_original_color = y->color; 
-    x = y->right; 
+    y = subtree_min(t, RIGHT(z)); 
+    size_detach(t, y, z);
+    y_original_color = COLOR(y); 
+    x = RIGHT(y); 
     
-    if (y->parent == z)
-      x->parent = y;
+    if (PARENT(y) == z)
+      xp = y;
     else {
-      rbtree_transplant(t, y, y->right);
-      y->right = z->right; 
-      y->right->parent = y; 
+      xp = PARENT(y);
+      rbtree_transplant(t, y, RIGHT(y));
+      SET_RIGHT(y, RIGHT(z)); 
+      SET_PARENT(RIGHT(y), y); 
     }
     
     rbtree_transplant(t, z, y); 
-    y->left = z->left;
-    y->left->parent = y; 
-    y->color = z->color; 
+    SET_LEFT(y, LEFT(z));
+    SET_PARENT(LEFT(y), y); 
+    SET_COLOR(y, COLOR(z)); 
+#ifdef RBTREE_ORDER_STAT
+    y->size = z->size;
+#endif
   }
-  free(z); 
 
   if (y_original_color == RBTREE_BLACK){
-    rbtree_erase_fixup(t, x);
+    rbtree_erase_fixup(t, x, xp);
   }
-  return 0; 
 }
 
 // 노드 v의 부모를 노드 u의 부모로 교체하는 함수
 void rbtree_transplant(rbtree *t, node_t *u, node_t *v) {
-  if (u->parent == t->nil) {
+  if (PARENT(u) == t->nil) {
     t->root = v;
   }
-  else if (u == u->parent->left) {
-    u->parent->left = v;
+  else if (u == LEFT(PARENT(u))) {
+    SET_LEFT(PARENT(u), v);
   }
-  else u->parent->right = v;
-  v->parent = u->parent;
+  else SET_RIGHT(PARENT(u), v);
+  if (v != t->nil)
+    SET_PARENT(v, PARENT(u));
 }
 
 
 // 노드 삭제 후 발생한 불균형을 복구하는 함수
-void rbtree_erase_fixup(rbtree *t, node_t *x){
-  while (x != t->root && x->color==RBTREE_BLACK)   
+// x는 nil일 수도 있으므로 x의 부모(xp)를 따로 받아서 공유 nil 노드에는 쓰지 않는다.
+void rbtree_erase_fixup(rbtree *t, node_t *x, node_t *xp){
+  while (x != t->root && COLOR(x)==RBTREE_BLACK)   
   {
-    if(x == x->parent->left){                       
-      node_t *w = x->parent->right; 
+    STAT_INC(t, erase_fixups);
+    if(x == LEFT(xp)){                       
+      node_t *w = RIGHT(xp); 
       
-      if(w->color == RBTREE_RED){                   
-        w->color = RBTREE_BLACK; 
-        x->parent->color = RBTREE_RED; 
-        left_rotate(t, x->parent); 
-        w = x->parent->right; 
+      if(COLOR(w) == RBTREE_RED){                   
+        RECOLOR(t, w, RBTREE_BLACK); 
+        RECOLOR(t, xp, RBTREE_RED); 
+        left_rotate(t, xp); 
+        w = RIGHT(xp); 
       }                                             
       
-      if(w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK){
-        w->color = RBTREE_RED; 
-        x = x->parent; 
+      if(COLOR(LEFT(w)) == RBTREE_BLACK && COLOR(RIGHT(w)) == RBTREE_BLACK){
+        RECOLOR(t, w, RBTREE_RED); 
+        x = xp; 
+        xp = PARENT(x);
       }else{                                        
-        if (w->right->color == RBTREE_BLACK){
-          w->left->color = RBTREE_BLACK; 
-          w->color = RBTREE_RED; 
+        if (COLOR(RIGHT(w)) == RBTREE_BLACK){
+          RECOLOR(t, LEFT(w), RBTREE_BLACK); 
+          RECOLOR(t, w, RBTREE_RED); 
           right_rotate(t, w); 
-          w = x->parent->right; 
+          w = RIGHT(xp); 
         }
-        w->color = x->parent->color; 
-        x->parent->color = RBTREE_BLACK; 
-        w->right->color = RBTREE_BLACK;
-        left_rotate(t, x->parent); 
+        RECOLOR(t, w, COLOR(xp)); 
+        RECOLOR(t, xp, RBTREE_BLACK); 
+        RECOLOR(t, RIGHT(w), RBTREE_BLACK);
+        left_rotate(t, xp); 
         x = t->root;
       }
     }else{                                  
-      node_t *w = x->parent->left;
-      if(w->color == RBTREE_RED){
-        w->color = RBTREE_BLACK;
-        x->parent->color = RBTREE_RED;
-        right_rotate(t, x->parent);
-        w = x->parent->left;
+      node_t *w = LEFT(xp);
+      if(COLOR(w) == RBTREE_RED){
+        RECOLOR(t, w, RBTREE_BLACK);
+        RECOLOR(t, xp, RBTREE_RED);
+        right_rotate(t, xp);
+        w = LEFT(xp);
       }
-      if(w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK){
-        w->color = RBTREE_RED;
-        x = x->parent;
+      if(COLOR(LEFT(w)) == RBTREE_BLACK && COLOR(RIGHT(w)) == RBTREE_BLACK){
+        RECOLOR(t, w, RBTREE_RED);
+        x = xp;
+        xp = PARENT(x);
       }else{ 
-        if (w->left->color == RBTREE_BLACK){
-          w->right->color = RBTREE_BLACK;
-          w->color = RBTREE_RED;
+        if (COLOR(LEFT(w)) == RBTREE_BLACK){
+          RECOLOR(t, RIGHT(w), RBTREE_BLACK);
+          RECOLOR(t, w, RBTREE_RED);
           left_rotate(t, w);
-          w = x->parent->left;
+          w = LEFT(xp);
         }
-        w->color = x->parent->color;
-        x->parent->color = RBTREE_BLACK;
-        w->left->color = RBTREE_BLACK;
-        right_rotate(t, x->parent);
+        RECOLOR(t, w, COLOR(xp));
+        RECOLOR(t, xp, RBTREE_BLACK);
+        RECOLOR(t, LEFT(w), RBTREE_BLACK);
+        right_rotate(t, xp);
         x = t->root;
       }      
     }
   }
-  x->color = RBTREE_BLACK;
+  if (x != t->nil)
+    RECOLOR(t, x, RBTREE_BLACK);
 }
 
+#endif
+
 /* 6. array로 변환 */
-// 트리의 노드들을 배열에 저장하는 함수
+// 트리의 노드들을 key 순서대로 최대 n개까지 배열에 저장하는 함수
 int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n) {
-  if (t->root != t->nil) {
-    inorder(t->root, t, arr,0);
+  if (NO_PARENT(t)) {
+    cow_to_array(t, arr, n);
+    return 0;
+  }
+  rbtree_cursor cur;
+  rbtree_cursor_init(&cur, t);
+  rbtree_to_array_next(t, &cur, arr, n);
+  return 0;
+}
+
+// rbtree_to_array_next로 트리의 처음부터 내보내도록 cursor를 초기화하는 함수
+void rbtree_cursor_init(rbtree_cursor *cur, const rbtree *t) {
+  cur->copy = 0;
+  if (NO_PARENT(t)) {
+    rbtree_iter_init(&cur->it, t);
+    cur->node = rbtree_iter_next(&cur->it);
+  } else {
+    cur->node = rbtree_min(t);
+  }
+}
+
+// cursor가 가리키는 노드 x의 다음 노드를 반환하는 함수
+// 부모 포인터가 없는 트리에서는 rbtree_next가 루트에서 다시 내려가므로 cursor의 스택으로 한 단계씩 나아간다.
+static node_t *cursor_step(const rbtree *t, rbtree_cursor *cursor, node_t *x) {
+  return NO_PARENT(t) ? rbtree_iter_next(&cursor->it) : rbtree_next(t, x);
+}
+
+// cursor부터 최대 n개의 key를 배열에 저장하고 저장한 개수를 반환하는 함수
+// cursor는 다음에 저장할 위치로 갱신되며, 끝까지 저장했으면 cur->node가 NULL이 된다.
+// rbtree_cursor_init으로 시작해 cur->node가 NULL이 될 때까지 반복 호출하면
+// 고정 크기 버퍼로 트리 전체를 나누어 내보낼 수 있다.
+// RBTREE_COUNTED 빌드에서는 노드의 key를 개수만큼 반복해 저장하고,
+// 버퍼가 중간에 차면 그 노드에서 이미 저장한 개수를 cur->copy에 기억했다가 다음 호출에서 이어서 저장한다.
+size_t rbtree_to_array_next(const rbtree *t, rbtree_cursor *cursor, key_t *arr, const size_t n) {
+  node_t *cur = cursor->node;
+  size_t i = 0;
+#ifdef RBTREE_COUNTED
+  size_t copy = cursor->copy;
+  while (cur != NULL && i < n) {
+    while (copy < cur->copies && i < n) {
+      arr[i++] = cur->key;
+      copy++;
+    }
+    if (copy < cur->copies)
+      break;
+    copy = 0;
+    cur = cursor_step(t, cursor, cur);
+  }
+  cursor->copy = copy;
+#else
+  while (cur != NULL && i < n) {
+    arr[i++] = cur->key;
+    cur = cursor_step(t, cursor, cur);
+  }
+#endif
+  cursor->node = cur;
+  return i;
+}
+
+/* 7. 정렬된 배열로부터 트리 생성 */
+// arr[lo, hi)로 균형 잡힌 서브트리를 만들어 루트를 반환하는 함수
+// 가운데 원소를 루트로 삼으므로 모든 리프의 깊이 차이가 1 이하가 되며,
+// red_depth 이상 깊이의 노드만 빨강으로 칠하면 black-height가 모두 같아진다.
+// runs가 NULL이 아니면 i번째 노드는 같은 key의 구간 arr[runs[i], runs[i + 1])을 한 노드에 담는다.
+// 노드 할당에 실패하면 NULL을 반환한다. (이미 만든 노드는 트리의 arena와 함께 해제된다)
+static node_t *build_sorted(rbtree *t, const key_t *arr, const size_t *runs, size_t lo, size_t hi,
+                            int depth, int red_depth) {
+  if (lo >= hi)
+    return t->nil;
+
+  // 왼쪽 서브트리를 먼저 만들어 노드를 key 순서대로 할당한다
+  // (RBTREE_TOPDOWN 빌드는 같은 key의 노드를 주소 순으로 두므로 이 순서에 기댄다)
+  size_t mid = lo + (hi - lo) / 2;
+  node_t *l = build_sorted(t, arr, runs, lo, mid, depth + 1, red_depth);
+  if (l == NULL)
+    return NULL;
+  node_t *x = node_alloc(t);
+  if (x == NULL)
+    return NULL;
+  x->key = arr[runs != NULL ? runs[mid] : mid];
+#ifdef RBTREE_COUNTED
+  x->copies = runs != NULL ? runs[mid + 1] - runs[mid] : 1;
+#endif
+  SET_PARENT(x, t->nil);
+  SET_COLOR(x, depth >= red_depth ? RBTREE_RED : RBTREE_BLACK);
+  SET_LEFT(x, l);
+  if (l != t->nil)
+    SET_PARENT(l, x);
+  node_t *r = build_sorted(t, arr, runs, mid + 1, hi, depth + 1, red_depth);
+  if (r == NULL)
+    return NULL;
+  SET_RIGHT(x, r);
+  if (r != t->nil)
+    SET_PARENT(r, x);
+#ifdef RBTREE_ORDER_STAT
+  x->size = runs != NULL ? runs[hi] - runs[lo] : hi - lo;
+#endif
+  return x;
+}
+
+// 정렬된 key 배열로 O(n) 시간에 트리를 생성하는 함수 (rbtree_to_array의 역연산)
+// 노드는 n개 크기의 arena 청크 하나에서 모두 할당된다. 할당에 실패하면 NULL을 반환한다.
+rbtree *rbtree_from_sorted(const key_t *arr, const size_t n) {
+  rbtree *t = new_rbtree_sized(n);
+  if (t == NULL)
+    return NULL;
+  size_t *runs = NULL, m = n;
+#ifdef RBTREE_COUNTED
+  // 같은 key의 연속 구간을 노드 하나로 묶는다 (runs[i]: i번째 구간의 시작)
+  runs = (size_t *)malloc((n + 1) * sizeof(size_t));
+  if (runs == NULL) {
+    delete_rbtree(t);
+    return NULL;
+  }
+  m = 0;
+  for (size_t i = 0; i < n; i++)
+    if (i == 0 || arr[i] != arr[i - 1] || i - runs[m - 1] == RBTREE_MAX_COPIES)
+      runs[m++] = i;
+  runs[m] = n;
+#endif
+
+  // 꽉 찬 레벨의 수 = floor(log2(m + 1)), 그 아래 레벨의 노드만 빨강
+  int red_depth = 0;
+  while (((size_t)2 << red_depth) - 1 <= m)
+    red_depth++;
+
+  node_t *root = build_sorted(t, arr, runs, 0, m, 0, red_depth);
+  free(runs);
+  if (root == NULL) {
+    // 만들다 만 노드는 arena 청크와 함께 해제된다
+    delete_rbtree(t);
+    return NULL;
+  }
+  t->root = root;
+  if (t->root != t->nil)
+    SET_COLOR(t->root, RBTREE_BLACK);
+  t->count = n;
+  return t;
+}
+
+/* 8. 여러 연산을 한 번에 적용 */
+// 배치 연산을 key 순서(같은 key는 입력 순서)로 정렬하기 위한 비교 함수
+static int batch_op_cmp(const void *a, const void *b) {
+  const rbtree_batch_op *x = *(rbtree_batch_op *const *)a;
+  const rbtree_batch_op *y = *(rbtree_batch_op *const *)b;
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+#ifndef RBTREE_TOPDOWN
+// finger(직전에 다룬 노드, finger->key <= key)에서 key가 들어갈 서브트리의 루트까지 올라가는 함수
+// 서브트리 바깥의 왼쪽 노드는 모두 finger->key 이하, 오른쪽 노드는 모두 key보다 크다.
+static node_t *finger_climb(const rbtree *t, node_t *x, const key_t key) {
+  while (x != t->root) {
+    node_t *p = PARENT(x);
+    if (x == LEFT(p) && key < p->key)
+      return x;
+    x = p;
+  }
+  return x;
+}
+#endif
+
+// 서브트리 x 안에서 key를 가진 노드를 찾는 함수 (없으면 NULL)
+static node_t *subtree_find(const rbtree *t, node_t *x, const key_t key) {
+  STAT_DESCENT_BEGIN(t);
+  while (x != t->nil) {
+    STAT_INC(t, comparisons);
+    if (x->key == key)
+      break;
+    x = x->key > key ? LEFT(x) : RIGHT(x);
+  }
+  STAT_DESCENT_END(t);
+  return x == t->nil ? NULL : x;
+}
+
+#ifndef RBTREE_TOPDOWN
+// 서브트리 x 안에서 key가 들어갈 자리에 새 노드를 연결하는 함수
+// 같은 key가 있다면 새 노드의 바로 앞 노드이므로 내려가는 경로에서 만나게 되어 *found에 기록한다.
+static node_t *subtree_insert(rbtree *t, node_t *x, const key_t key, int *found) {
+  node_t *parent = x == t->root ? t->nil : PARENT(x);
+  STAT_DESCENT_BEGIN(t);
+  while (x != t->nil) {
+    STAT_INC(t, comparisons);
+    if (x->key == key) {
+      *found = 1;
+#ifdef RBTREE_COUNTED
+      if (x->copies < RBTREE_MAX_COPIES) {
+        STAT_DESCENT_END(t);
+        copies_change(t, x, 1);
+        return x;
+      }
+#endif
+    }
+    parent = x;
+    x = x->key > key ? LEFT(x) : RIGHT(x);
+  }
+  STAT_DESCENT_END(t);
+
+  node_t *addnode = new_node(t, key);
+  if (addnode == NULL)
+    return NULL;
+  attach_node(t, parent, addnode);
+  return addnode;
+}
+#endif
+
+// 삽입/삭제/탐색 연산 n개를 key 순서로 정렬해 한 번의 순회로 적용하는 함수
+// 매번 루트에서 출발하는 대신 직전 연산의 노드(finger)에서 필요한 만큼만 올라갔다 내려간다.
+// 결과는 각 연산의 node(삽입/탐색된 노드, 삭제는 NULL)와 found(기존 key 존재 여부)에 기록된다.
+int rbtree_apply_batch(rbtree *t, rbtree_batch_op *ops, const size_t n) {
+  // copy-on-write 트리는 finger에서 부모로 올라갈 수도, 공유하는 노드를 고칠 수도 없다
+  if (t->cow != NULL)
+    return -1;
+  // intrusive 트리에는 노드를 할당해 넣을 수 없다 (삭제와 탐색만 가능)
+  for (size_t i = 0; i < n && t->intrusive; i++)
+    if (ops[i].op == RBTREE_OP_INSERT)
+      return -1;
+  rbtree_batch_op **order = (rbtree_batch_op **)malloc(n * sizeof(*order));
+  if (order == NULL && n > 0)
+    return -1;
+  for (size_t i = 0; i < n; i++)
+    order[i] = &ops[i];
+  qsort(order, n, sizeof(*order), batch_op_cmp);
+
+#ifdef RBTREE_TOPDOWN
+  // 부모 포인터가 없어 finger에서 올라갈 수 없으므로, 정렬된 순서대로 매번 루트에서 내려간다
+  for (size_t i = 0; i < n; i++) {
+    rbtree_batch_op *op = order[i];
+    switch (op->op) {
+      case RBTREE_OP_INSERT:
+        op->found = subtree_find(t, t->root, op->key) != NULL;
+        op->node = rbtree_insert(t, op->key);
+        if (op->node == NULL) {
+          free(order);
+          return -1;
+        }
+        break;
+      case RBTREE_OP_FIND:
+        op->node = subtree_find(t, t->root, op->key);
+        op->found = op->node != NULL;
+        break;
+      case RBTREE_OP_ERASE:
+        op->found = rbtree_erase_key(t, op->key);
+        op->node = NULL;
+        break;
+    }
+  }
+#else
+  node_t *finger = NULL;
+  for (size_t i = 0; i < n; i++) {
+    rbtree_batch_op *op = order[i];
+    node_t *start = t->root;
+    node_t *hit = NULL;
+
+    if (finger != NULL) {
+      if (finger->key == op->key && op->op != RBTREE_OP_INSERT)
+        hit = finger;
+      start = finger_climb(t, finger, op->key);
+    }
+
+    switch (op->op) {
+      case RBTREE_OP_INSERT:
+        op->found = finger != NULL && finger->key == op->key;
+#ifdef RBTREE_COUNTED
+        // 같은 key의 finger는 서브트리 바깥에 있으므로 여기서 개수를 늘린다
+        if (op->found && finger->copies < RBTREE_MAX_COPIES) {
+          copies_change(t, finger, 1);
+          op->node = finger;
+          break;
+        }
+#endif
+        op->node = subtree_insert(t, start, op->key, &op->found);
+        if (op->node == NULL) {
+          free(order);
+          return -1;
+        }
+        finger = op->node;
+        break;
+      case RBTREE_OP_FIND:
+        if (hit == NULL)
+          hit = subtree_find(t, start, op->key);
+        op->found = hit != NULL;
+        op->node = hit;
+        if (hit != NULL)
+          finger = hit;
+        break;
+      case RBTREE_OP_ERASE:
+        if (hit == NULL)
+          hit = subtree_find(t, start, op->key);
+        op->found = hit != NULL;
+        op->node = NULL;
+        if (hit != NULL) {
+          // 삭제된 노드 대신 바로 앞 노드를 finger로 남긴다 (rbtree_erase는 다른 노드를 옮기지만 해제하지 않음)
+          finger = rbtree_prev(t, hit);
+          rbtree_erase(t, hit);
+        }
+        break;
+    }
   }
+#endif
+
+  free(order);
   return 0;
 }
 
-// 중위 순회하며 트리의 노드들을 배열에 저장하는 함수
-int inorder(node_t *x, const rbtree *t, key_t *arr, int i){
-  if(x == t->nil) 
-    return i;
-  i = inorder(x->left ,t,arr,i); 
-  arr[i++] = x->key; 
-  i = inorder(x->right,t,arr,i); 
+#ifndef RBTREE_TOPDOWN
+// hint에서 올라가며 key가 들어갈 자리를 포함하는 가장 낮은 서브트리의 루트를 찾는 함수
+// 서브트리의 범위는 처음 만나는 왼쪽 링크 조상(상한)과 오른쪽 링크 조상(하한)이 정한다.
+// 어느 한쪽이 key를 벗어나면 그 조상으로 옮겨 가며, 그 조상의 반대쪽 경계는 자동으로 만족된다.
+// (하한도 엄격하게 비교해 같은 key의 조상은 서브트리 안에 들어오게 한다: RBTREE_COUNTED에서 개수를 늘리기 위해)
+static node_t *hint_climb(const rbtree *t, node_t *x, const key_t key) {
+  int need_lo = 1, need_hi = 1;
+  for (node_t *y = x; y != t->root && (need_lo || need_hi);) {
+    node_t *p = PARENT(y);
+    if (y == LEFT(p)) {
+      if (need_hi) {
+        STAT_INC(t, comparisons);
+        if (key < p->key) {
+          need_hi = 0;
+        } else {
+          x = p;
+          need_lo = 0;
+        }
+      }
+    } else if (need_lo) {
+      STAT_INC(t, comparisons);
+      if (p->key < key) {
+        need_lo = 0;
+      } else {
+        x = p;
+        need_hi = 0;
+      }
+    }
+    y = p;
+  }
+  return x;
+}
+#endif
+
+// hint 노드 근처에 key를 추가하는 함수 (hint가 NULL이면 최대 노드에서 출발)
+// hint에서 key를 포함하는 서브트리까지만 올라갔다 내려가므로, 직전에 추가한 노드를 hint로 넘기면
+// 거의 정렬된 입력을 거리 d마다 O(log d)에 넣는다. 최대 노드는 트리에 기억해 두므로
+// 최댓값 이상인 key는 hint 없이도 O(1)에 자리를 찾는다. 균형 복구는 rbtree_insert와 같다.
+node_t *rbtree_insert_hint(rbtree *t, node_t *hint, const key_t key) {
+#ifdef RBTREE_TOPDOWN
+  // 부모 포인터가 없어 hint에서 올라갈 수 없으므로 루트에서 내려간다
+  (void)hint;
+  return rbtree_insert(t, key);
+#else
+  if (t->cow != NULL || t->root == t->nil || t->intrusive)
+    return rbtree_insert(t, key);
+  if (t->rightmost == NULL)
+    t->rightmost = subtree_max(t, t->root);
+  if (hint == NULL)
+    hint = t->rightmost;
+
+  node_t *start = hint;
+  int found = 0;
+  // 최대 노드 이상이면 최대 노드의 오른쪽이 자리이므로 올라갈 필요가 없다
+  if (hint != t->rightmost || key < hint->key)
+    start = hint_climb(t, hint, key);
+  return subtree_insert(t, start, key, &found);
+#endif
+}
+
+/* 9. 순서 통계 (order statistic) */
+// 트리의 노드 수를 O(1)에 반환하는 함수
+size_t rbtree_size(const rbtree *t) {
+  return t->count;
+}
+
+// key 순서로 k번째(0부터 시작) 노드를 반환하는 함수 (k >= 크기면 NULL)
+// RBTREE_ORDER_STAT 빌드에서는 서브트리 크기를 보고 내려가므로 O(log n)
+node_t *rbtree_select(const rbtree *t, size_t k) {
+  if (k >= t->count)
+    return NULL;
+#ifdef RBTREE_ORDER_STAT
+  node_t *x = ROOT(t);
+  while (x != t->nil) {
+    size_t left = LEFT(x)->size;
+    if (k >= left && k < left + COPIES(x))
+      return x;
+    if (k < left) {
+      x = LEFT(x);
+    } else {
+      k -= left + COPIES(x);
+      x = RIGHT(x);
+    }
+  }
+  return NULL;
+#else
+  rbtree_iter it;
+  rbtree_iter_init(&it, t);
+  node_t *x = rbtree_iter_next(&it);
+  while (k >= COPIES(x)) {
+    k -= COPIES(x);
+    x = rbtree_iter_next(&it);
+  }
+  return x;
+#endif
+}
+
+// key보다 작은 key의 개수를 반환하는 함수
+// RBTREE_ORDER_STAT 빌드에서는 O(log n), 그 외에는 작은 key들을 순회하므로 O(rank)
+size_t rbtree_rank(const rbtree *t, const key_t key) {
+  size_t rank = 0;
+#ifdef RBTREE_ORDER_STAT
+  node_t *x = ROOT(t);
+  while (x != t->nil) {
+    if (x->key < key) {
+      rank += LEFT(x)->size + COPIES(x);
+      x = RIGHT(x);
+    } else {
+      x = LEFT(x);
+    }
+  }
+#else
+  rbtree_iter it;
+  rbtree_iter_init(&it, t);
+  for (node_t *x = rbtree_iter_next(&it); x != NULL && x->key < key; x = rbtree_iter_next(&it))
+    rank += COPIES(x);
+#endif
+  return rank;
+}
+
+/* 10. 범위 탐색 */
+// key 이상인 key를 가진 노드 중 가장 왼쪽 노드를 반환하는 함수 (없으면 NULL)
+// 중복 key가 있으면 그중 첫 번째 노드를 반환한다.
+node_t *rbtree_lower_bound(const rbtree *t, const key_t key) {
+  node_t *x = ROOT(t);
+  node_t *res = NULL;
+  STAT_DESCENT_BEGIN(t);
+  while (x != t->nil) {
+    STAT_INC(t, comparisons);
+    if (x->key >= key) {
+      res = x;
+      x = LEFT(x);
+    } else {
+      x = RIGHT(x);
+    }
+  }
+  STAT_DESCENT_END(t);
+  return res;
+}
+
+// key보다 큰 key를 가진 노드 중 가장 왼쪽 노드를 반환하는 함수 (없으면 NULL)
+node_t *rbtree_upper_bound(const rbtree *t, const key_t key) {
+  node_t *x = ROOT(t);
+  node_t *res = NULL;
+  STAT_DESCENT_BEGIN(t);
+  while (x != t->nil) {
+    STAT_INC(t, comparisons);
+    if (x->key > key) {
+      res = x;
+      x = LEFT(x);
+    } else {
+      x = RIGHT(x);
+    }
+  }
+  STAT_DESCENT_END(t);
+  return res;
+}
+
+// 반복자가 key 이상인 첫 노드부터 돌려주도록 스택을 채우는 함수 (rbtree_lower_bound와 같은 경로)
+// 부모 포인터를 쓰지 않으므로 RBTREE_TOPDOWN 빌드와 copy-on-write 트리에서도 O(log n + k)로 범위를 돈다.
+static void iter_seek(rbtree_iter *it, const rbtree *t, const key_t key) {
+  it->tree = t;
+  it->top = 0;
+  for (node_t *x = ROOT(t); x != t->nil;) {
+    if (x->key >= key) {
+      it->stack[it->top++] = x;
+      x = LEFT(x);
+    } else {
+      x = RIGHT(x);
+    }
+  }
+}
+
+// [lo, hi) 범위에 있는 key의 개수를 반환하는 함수
+// RBTREE_ORDER_STAT 빌드에서는 O(log n), 그 외에는 O(log n + k)
+size_t rbtree_range_count(const rbtree *t, const key_t lo, const key_t hi) {
+  if (lo >= hi)
+    return 0;
+#ifdef RBTREE_ORDER_STAT
+  return rbtree_rank(t, hi) - rbtree_rank(t, lo);
+#else
+  size_t cnt = 0;
+  rbtree_iter it;
+  iter_seek(&it, t, lo);
+  for (node_t *x = rbtree_iter_next(&it); x != NULL && x->key < hi; x = rbtree_iter_next(&it))
+    cnt += COPIES(x);
+  return cnt;
+#endif
+}
+
+// [lo, hi) 범위의 key를 순서대로 최대 cap개 배열에 저장하고 저장한 개수를 반환하는 함수 (O(log n + k))
+size_t rbtree_range_to_array(const rbtree *t, const key_t lo, const key_t hi, key_t *arr, const size_t cap) {
+  size_t i = 0;
+  rbtree_iter it;
+  iter_seek(&it, t, lo);
+  for (node_t *x = rbtree_iter_next(&it); x != NULL && x->key < hi && i < cap; x = rbtree_iter_next(&it))
+    for (size_t c = COPIES(x); c > 0 && i < cap; c--)
+      arr[i++] = x->key;
   return i;
-}
\ No newline at end of file
+}
+
+/* 11. key/value 맵 */
+// 값은 노드 바로 뒤, 8바이트 경계에서 시작한다.
+#define VALUE_OFFSET ((sizeof(node_t) + 7) & ~(size_t)7)
+
+// 노드마다 value_size 바이트의 값을 노드 바로 뒤에 함께 저장하는 트리를 생성하는 함수
+// 노드는 hint 크기의 arena 청크에서 할당되므로 key와 값이 같은 캐시 라인 근처에 놓인다.
+rbtree *new_rbtree_map(const size_t value_size, const size_t hint) {
+  rbtree *t = new_rbtree_sized(hint);
+  if (t == NULL)
+    return NULL;
+  const size_t align = RBTREE_NODE_ALIGN;
+  t->value_size = value_size;
+  t->node_size = (VALUE_OFFSET + value_size + align - 1) / align * align;
+  return t;
+}
+
+// 노드에 저장된 값의 주소를 반환하는 함수
+void *rbtree_map_value(const node_t *node) {
+  return (char *)node + VALUE_OFFSET;
+}
+
+// 새 노드의 값 공간을 채우는 함수 (value가 NULL이면 0으로 채움)
+static void map_store(const rbtree *t, node_t *node, const void *value) {
+  if (value != NULL)
+    memcpy(rbtree_map_value(node), value, t->value_size);
+  else
+    memset(rbtree_map_value(node), 0, t->value_size);
+}
+
+// key와 값을 추가하는 함수 (multiset이므로 같은 key가 있어도 하나 더 추가)
+// RBTREE_COUNTED 빌드는 같은 key가 한 노드와 그 값을 함께 쓰므로, 기존 값을 덮어쓰지 않도록
+// 같은 key가 이미 있으면 추가하지 않고 NULL을 반환한다. (값을 바꾸려면 rbtree_map_upsert)
+node_t *rbtree_map_insert(rbtree *t, const key_t key, const void *value) {
+#ifdef RBTREE_COUNTED
+  int inserted;
+  node_t *node = rbtree_insert_unique(t, key, &inserted);
+  if (!inserted)
+    return NULL;
+#else
+  node_t *node = rbtree_insert(t, key);
+#endif
+  if (node != NULL)
+    map_store(t, node, value);
+  return node;
+}
+
+// key에 해당하는 값의 주소를 반환하는 함수 (없으면 NULL)
+void *rbtree_map_get(const rbtree *t, const key_t key) {
+  node_t *node = rbtree_find(t, key);
+  return node == NULL ? NULL : rbtree_map_value(node);
+}
+
+// key가 있으면 그 값을 덮어쓰고, 없으면 새로 추가하는 함수
+// find 후 insert하는 대신 한 번만 내려가며, 덮어쓰거나 추가한 노드를 반환한다.
+node_t *rbtree_map_upsert(rbtree *t, const key_t key, const void *value) {
+  // copy-on-write 트리의 노드는 reader와 공유되므로 제자리에서 덮어쓸 수 없다
+  if (t->cow != NULL)
+    return NULL;
+#ifdef RBTREE_TOPDOWN
+  // 내려가며 균형을 맞추는 삽입이 같은 key에서 멈추므로 덮어쓰기와 추가가 같은 경로다
+  int inserted;
+  node_t *node = td_insert(t, key, 1, &inserted);
+  if (node != NULL)
+    map_store(t, node, value);
+  return node;
+#else
+  node_t *cur = t->root;
+  node_t *parent = t->nil;
+  STAT_DESCENT_BEGIN(t);
+  while (cur != t->nil) {
+    STAT_INC(t, comparisons);
+    if (cur->key == key)
+      break;
+    parent = cur;
+    cur = cur->key > key ? LEFT(cur) : RIGHT(cur);
+  }
+  STAT_DESCENT_END(t);
+  if (cur != t->nil) {
+    map_store(t, cur, value);
+    return cur;
+  }
+
+  node_t *node = new_node(t, key);
+  if (node == NULL)
+    return NULL;
+  map_store(t, node, value);
+  attach_node(t, parent, node);
+  return node;
+#endif
+}
+
+/* 12. 내부 동작 통계 */
+#ifdef RBTREE_STATS
+// 트리의 카운터를 out에 복사하는 함수
+void rbtree_stats_get(const rbtree *t, rbtree_stats *out) {
+  *out = *t->stats;
+}
+
+// 트리의 카운터를 모두 0으로 되돌리는 함수
+void rbtree_stats_reset(rbtree *t) {
+  memset(t->stats, 0, sizeof(rbtree_stats));
+}
+#endif
+
+/* 13. intrusive 트리 */
+// (인덱스 모드의 노드는 pool 안에 있어야 하므로 intrusive 트리를 지원하지 않는다.
+//  RBTREE_TOPDOWN 빌드도 rb_link에 부모 포인터가 없어 지원하지 않는다)
+#if !defined(RBTREE_INDEX32) && !defined(RBTREE_TOPDOWN)
+// 노드를 할당/해제하지 않고, 호출한 쪽 구조체에 들어 있는 rb_link를 연결만 하는 트리를 생성하는 함수
+rbtree *new_rbtree_intrusive(void) {
+  rbtree *t = new_rbtree();
+  if (t == NULL)
+    return NULL;
+  t->intrusive = 1;
+  return t;
+}
+
+// link->key에 key를 채운 rb_link를 트리에 연결하는 함수 (rbtree_insert와 같은 자리, 같은 fixup)
+node_t *rbtree_link(rbtree *t, rb_link *link) {
+  // copy-on-write 트리는 경로를 복사해야 하므로 호출한 쪽의 링크를 제자리에 연결할 수 없다
+  if (t->cow != NULL)
+    return NULL;
+  node_t *cur = t->root;
+  node_t *parent = t->nil;
+  STAT_DESCENT_BEGIN(t);
+  while (cur != t->nil) {
+    parent = cur;
+    STAT_INC(t, comparisons);
+    cur = cur->key > link->key ? LEFT(cur) : RIGHT(cur);
+  }
+  STAT_DESCENT_END(t);
+
+  SET_LEFT(link, t->nil);
+  SET_RIGHT(link, t->nil);
+  SET_COLOR(link, RBTREE_RED);
+  attach_node(t, parent, link);
+  return link;
+}
+
+// 연결된 rb_link를 트리에서 떼어내는 함수 (rbtree_erase와 같은 fixup, 메모리는 그대로)
+void rbtree_unlink(rbtree *t, rb_link *link) {
+  detach_node(t, link);
+}
+#endif
+
+/* 14. 동시 접근 래퍼 (seqlock) */
+// 쓰기는 mutex로 직렬화하고, 읽기는 잠그지 않고 진행한 뒤 그 사이 쓰기가 있었으면 다시 시도한다.
+// 노드는 zeroed arena에서만 할당되고 트리를 지울 때까지 해제되지 않으므로,
+// 쓰기와 겹친 읽기가 따라간 링크는 항상 NULL, nil 또는 arena 안의 노드를 가리킨다.
+#define SYNC_MAX_DEPTH 128  // 높이 <= 2log2(n+1) 이므로 이보다 깊으면 쓰기와 겹친 것
+#define SYNC_MAX_RETRY 16   // 이만큼 실패하면 mutex를 잡고 읽는다
+
+struct rbtree_sync {
+  rbtree *tree;
+  unsigned long seq;  // 쓰기 중이면 홀수
+  pthread_mutex_t lock;
+};
+
+// 읽기 결과: 성공, 읽는 도중 구조가 깨져 보여서 다시 시도
+enum { SYNC_OK, SYNC_TORN };
+
+// 동시 접근 트리를 생성하는 함수 (hint: 예상 노드 수)
+rbtree_sync *new_rbtree_sync(const size_t hint) {
+  rbtree_sync *s = (rbtree_sync *)calloc(1, sizeof(rbtree_sync));
+  if (s == NULL)
+    return NULL;
+  s->tree = new_rbtree_sized(hint);
+  if (s->tree == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->tree->arena->zeroed = 1;
+  pthread_mutex_init(&s->lock, NULL);
+  return s;
+}
+
+// 동시 접근 트리를 삭제하는 함수 (다른 스레드가 사용하고 있지 않아야 한다)
+void delete_rbtree_sync(rbtree_sync *s) {
+  pthread_mutex_destroy(&s->lock);
+  delete_rbtree(s->tree);
+  free(s);
+}
+
+// 쓰기 구간을 시작하고 내부 트리를 반환하는 함수
+// 반환된 트리로 임의의 수정 연산을 한 뒤 rbtree_sync_write_unlock을 호출한다.
+rbtree *rbtree_sync_write_lock(rbtree_sync *s) {
+  pthread_mutex_lock(&s->lock);
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);  // seq 증가가 노드 수정보다 먼저 보이도록
+  return s->tree;
+}
+
+void rbtree_sync_write_unlock(rbtree_sync *s) {
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&s->lock);
+}
+
+// key를 추가하는 함수 (실패하면 -1)
+int rbtree_sync_insert(rbtree_sync *s, const key_t key) {
+  rbtree *t = rbtree_sync_write_lock(s);
+  node_t *node = rbtree_insert(t, key);
+  rbtree_sync_write_unlock(s);
+  return node == NULL ? -1 : 0;
+}
+
+// key를 가진 노드 하나를 삭제하는 함수 (삭제했으면 1, 없으면 0)
+int rbtree_sync_erase(rbtree_sync *s, const key_t key) {
+  rbtree *t = rbtree_sync_write_lock(s);
+  node_t *node = rbtree_find(t, key);
+  if (node != NULL)
+    rbtree_erase(t, node);
+  rbtree_sync_write_unlock(s);
+  return node != NULL;
+}
+
+// 진행 중인 쓰기가 없을 때의 seq를 반환하는 함수
+static unsigned long sync_read_begin(const rbtree_sync *s) {
+  unsigned long seq;
+  while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+    sched_yield();
+  return seq;
+}
+
+// 읽기를 시작한 뒤 쓰기가 있었는지 확인하는 함수
+static int sync_read_changed(const rbtree_sync *s, const unsigned long seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);  // 노드 읽기가 seq 재확인보다 먼저 끝나도록
+  return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// 잠그지 않고 읽는 함수들: 링크는 한 번씩만 읽고, 깊이를 제한해 깨진 구조에서도 멈추지 않는다.
+static int sync_find(const rbtree *t, const key_t key, int *found) {
+  node_t *x = t->root;
+  for (int depth = 0; x != t->nil; depth++) {
+    if (x == NULL || depth == SYNC_MAX_DEPTH)
+      return SYNC_TORN;
+    const key_t k = x->key;
+    if (k == key) {
+      *found = 1;
+      return SYNC_OK;
+    }
+    x = k > key ? LEFT(x) : RIGHT(x);
+  }
+  *found = 0;
+  return SYNC_OK;
+}
+
+// 가장 왼쪽(dir == 0) 또는 가장 오른쪽 key를 읽는 함수
+static int sync_edge(const rbtree *t, const int dir, key_t *out, int *found) {
+  node_t *x = t->root;
+  *found = 0;
+  for (int depth = 0; x != t->nil; depth++) {
+    if (x == NULL || depth == SYNC_MAX_DEPTH)
+      return SYNC_TORN;
+    *out = x->key;
+    *found = 1;
+    x = dir == 0 ? LEFT(x) : RIGHT(x);
+  }
+  return SYNC_OK;
+}
+
+// [lo, hi) 범위의 key를 최대 cap개 읽는 함수 (부모 포인터 대신 스택으로 중위 순회)
+static int sync_range(const rbtree *t, const key_t lo, const key_t hi, key_t *arr,
+                      const size_t cap, size_t *cnt) {
+  node_t *stack[SYNC_MAX_DEPTH];
+  int top = 0;
+  size_t i = 0;
+  node_t *x = t->root;
+  while (i < cap) {
+    // lo 이상인 노드만 스택에 쌓으며 왼쪽으로 내려간다
+    while (x != t->nil) {
+      if (x == NULL || top == SYNC_MAX_DEPTH)
+        return SYNC_TORN;
+      if (x->key >= lo) {
+        stack[top++] = x;
+        x = LEFT(x);
+      } else {
+        x = RIGHT(x);
+      }
+    }
+    if (top == 0)
+      break;
+    x = stack[--top];
+    const key_t k = x->key;
+    if (k >= hi)
+      break;
+    for (size_t c = COPIES(x); c > 0 && i < cap; c--)
+      arr[i++] = k;
+    x = RIGHT(x);
+  }
+  *cnt = i;
+  return SYNC_OK;
+}
+
+// 읽기 호출 call을 쓰기와 겹치지 않을 때까지 반복하는 매크로
+// SYNC_MAX_RETRY번 실패하면 mutex를 잡고 한 번 더 읽으므로 쓰기가 많아도 반드시 끝난다.
+#define SYNC_READ(s, call)                                       \
+  do {                                                           \
+    const rbtree *t = (s)->tree;                                 \
+    int ok = 0;                                                  \
+    for (int retry = 0; !ok && retry < SYNC_MAX_RETRY; retry++) { \
+      const unsigned long seq = sync_read_begin(s);              \
+      ok = (call) == SYNC_OK && !sync_read_changed(s, seq);      \
+    }                                                            \
+    if (!ok) {                                                   \
+      pthread_mutex_lock(&(s)->lock);                            \
+      (void)(call);                                              \
+      pthread_mutex_unlock(&(s)->lock);                          \
+    }                                                            \
+  } while (0)
+
+// key가 있으면 1, 없으면 0을 반환하는 함수
+int rbtree_sync_find(rbtree_sync *s, const key_t key) {
+  int found = 0;
+  SYNC_READ(s, sync_find(t, key, &found));
+  return found;
+}
+
+// 최소 key를 *out에 저장하는 함수 (빈 트리면 0을 반환)
+int rbtree_sync_min(rbtree_sync *s, key_t *out) {
+  int found = 0;
+  SYNC_READ(s, sync_edge(t, 0, out, &found));
+  return found;
+}
+
+// 최대 key를 *out에 저장하는 함수 (빈 트리면 0을 반환)
+int rbtree_sync_max(rbtree_sync *s, key_t *out) {
+  int found = 0;
+  SYNC_READ(s, sync_edge(t, 1, out, &found));
+  return found;
+}
+
+// [lo, hi) 범위의 key를 순서대로 최대 cap개 저장하고 저장한 개수를 반환하는 함수
+size_t rbtree_sync_range(rbtree_sync *s, const key_t lo, const key_t hi, key_t *arr, const size_t cap) {
+  size_t cnt = 0;
+  SYNC_READ(s, sync_range(t, lo, hi, arr, cap, &cnt));
+  return cnt;
+}
+
+/* 15. key 범위로 나눈 동시 접근 컨테이너 (sharded) */
+// 전체 key 범위를 shard 수만큼 나누고, shard마다 독립된 트리와 lock을 둔다.
+// shard i는 [lo_i, lo_{i+1}) 범위의 key를 가지며, 경계 lo_i는 shard i-1과 i의 lock을 모두 잡았을 때만 바뀐다.
+// 따라서 shard i의 lock만 잡아도 그 shard의 경계 두 개는 바뀌지 않는다.
+#define SHARD_SLACK 1024  // 이웃보다 이만큼(+2배) 이상 커지면 경계를 옮긴다
+
+typedef struct {
+  _Alignas(64) pthread_mutex_t lock;  // shard마다 다른 캐시 라인에 둔다
+  rbtree *tree;
+  long long lo;  // 이 shard가 가지는 가장 작은 key (마지막 shard 뒤는 LLONG_MAX)
+  size_t hold;   // tree->count가 이 값을 넘기 전에는 이웃과 크기를 비교하지 않는다
+} rbtree_shard;
+
+struct rbtree_sharded {
+  size_t n;
+  rbtree_shard *shards;
+};
+
+// shard n개로 key 범위 전체를 고르게 나눈 컨테이너를 생성하는 함수
+rbtree_sharded *new_rbtree_sharded(const size_t n) {
+  if (n == 0)
+    return NULL;
+  rbtree_sharded *s = (rbtree_sharded *)calloc(1, sizeof(rbtree_sharded));
+  if (s == NULL)
+    return NULL;
+  s->shards = (rbtree_shard *)aligned_alloc(_Alignof(rbtree_shard), n * sizeof(rbtree_shard));
+  if (s->shards == NULL) {
+    free(s);
+    return NULL;
+  }
+  const long long span = (long long)INT_MAX - INT_MIN + 1;
+  for (size_t i = 0; i < n; i++) {
+    s->shards[i].tree = new_rbtree_sized(0);
+    if (s->shards[i].tree == NULL) {
+      // 이미 만든 shard만 되돌린다
+      delete_rbtree_sharded(s);
+      return NULL;
+    }
+    pthread_mutex_init(&s->shards[i].lock, NULL);
+    s->shards[i].lo = INT_MIN + span / (long long)n * (long long)i;
+    s->shards[i].hold = 0;
+    s->n = i + 1;
+  }
+  return s;
+}
+
+// 컨테이너를 삭제하는 함수 (다른 스레드가 사용하고 있지 않아야 한다)
+void delete_rbtree_sharded(rbtree_sharded *s) {
+  for (size_t i = 0; i < s->n; i++) {
+    pthread_mutex_destroy(&s->shards[i].lock);
+    delete_rbtree(s->shards[i].tree);
+  }
+  free(s->shards);
+  free(s);
+}
+
+static long long shard_lo(const rbtree_sharded *s, const size_t i) {
+  return i == s->n ? LLONG_MAX : __atomic_load_n(&s->shards[i].lo, __ATOMIC_RELAXED);
+}
+
+// key를 가진 shard의 lock을 잡고 그 번호를 반환하는 함수
+// 경계는 lock 없이 이분 탐색하므로, lock을 잡은 뒤 범위를 다시 확인하고 어긋나면 다시 찾는다.
+static size_t shard_lock_key(rbtree_sharded *s, const key_t key) {
+  for (;;) {
+    size_t lo = 0, hi = s->n;  // lo_i <= key 인 마지막 i
+    while (hi - lo > 1) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (shard_lo(s, mid) <= key)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    pthread_mutex_lock(&s->shards[lo].lock);
+    if (shard_lo(s, lo) <= key && key < shard_lo(s, lo + 1))
+      return lo;
+    pthread_mutex_unlock(&s->shards[lo].lock);
+  }
+}
+
+// 크기를 비교한 뒤 다음에 비교할 크기 (count가 1/4 더 늘어날 때까지 lock 세 개를 다시 잡지 않는다)
+static size_t shard_next_check(const rbtree *t) {
+  return t->count + t->count / 4;
+}
+
+// shard i에서 이웃 j로 보낼 key 범위를 정하고 옮길 key 수를 반환하는 함수 (i와 j의 lock을 잡은 상태)
+// j 쪽 가장자리부터 같은 key를 한 묶음으로 세어, 묶음을 더할 때마다 두 크기의 차이가 줄어들고
+// 받은 쪽이 다시 경계를 옮길 만큼 커지지 않는 동안만 더한다. 하나도 더할 수 없으면 0을 반환한다.
+// 옮길 범위는 오른쪽으로 보낼 때 key >= *cut, 왼쪽으로 보낼 때 key < *cut이다.
+static size_t shard_plan(const rbtree *from, const rbtree *to, const int right, long long *cut) {
+  const size_t ci = from->count, cj = to->count;
+  size_t m = 0;
+  node_t *x = right ? rbtree_max(from) : rbtree_min(from);
+  while (x != NULL) {
+    const key_t key = x->key;
+    // 차이가 줄어들려면 m + run < ci - cj - m 이어야 하므로, 그 이상은 세지 않는다
+    const size_t limit = ci - cj - 2 * m;
+    size_t run = 0;
+    while (x != NULL && x->key == key && run < limit) {
+      run += COPIES(x);
+      x = right ? rbtree_prev(from, x) : rbtree_next(from, x);
+    }
+    if (run >= limit || cj + m + run > 2 * (ci - m - run) + SHARD_SLACK)
+      break;
+    m += run;
+    *cut = right ? (long long)key : (long long)key + 1;
+    if (2 * m >= ci - cj)
+      break;
+  }
+  return m;
+}
+
+// shard i의 key 일부를 이웃 shard j로 옮겨 두 shard의 크기를 맞추고, 옮겼으면 1을 반환하는 함수 (두 lock을 모두 잡은 상태)
+// 같은 key는 항상 한 shard에 모이므로, 한 key가 몰린 shard는 옮겨도 고르게 되지 않으면 그대로 둔다.
+static int shard_move(rbtree_sharded *s, const size_t i, const size_t j) {
+  rbtree *from = s->shards[i].tree, *to = s->shards[j].tree;
+  const int right = j > i;
+  long long cut;
+  if (shard_plan(from, to, right, &cut) == 0)
+    return 0;
+
+#ifndef RBTREE_TOPDOWN
+  // 범위를 한 번 나누고 한 번 붙이므로 옮기는 key 수와 관계없이 균형 복구는 O(log n)이다.
+  // shard마다 arena가 따로 있으므로 떼어낸 노드는 from의 arena에 돌려주고,
+  // 같은 key로 to 쪽에서 새로 만든 트리(자기 arena)를 붙인다 (결합하면 그 arena는 to의 arena에 합쳐진다).
+  rbtree *l, *r;
+  if (rbtree_split(from, (key_t)cut, &l, &r) == 0) {
+    rbtree *part = right ? r : l, *keep = right ? l : r;
+    key_t *keys = (key_t *)malloc(part->count * sizeof(key_t));
+    rbtree *built = NULL;
+    if (keys != NULL) {
+      rbtree_to_array(part, keys, part->count);
+      built = rbtree_from_sorted(keys, part->count);
+      free(keys);
+    }
+    if (built == NULL) {
+      // 할당에 실패하면 나눈 두 트리를 다시 붙이고 옮기지 않는다
+      s->shards[i].tree = right ? rbtree_join(keep, NULL, part) : rbtree_join(part, NULL, keep);
+      return 0;
+    }
+    free_subtree(part, part->root);
+    part->root = part->nil;
+    delete_rbtree(part);
+    s->shards[i].tree = keep;
+    s->shards[j].tree = right ? rbtree_join(built, NULL, to) : rbtree_join(to, NULL, built);
+  } else
+#endif
+  {
+    for (;;) {
+      node_t *x = right ? rbtree_max(from) : rbtree_min(from);
+      if (x == NULL || (right ? x->key < cut : x->key >= cut))
+        break;
+      const key_t key = x->key;
+      rbtree_erase(from, x);
+      rbtree_insert(to, key);
+    }
+  }
+  // 오른쪽으로 옮겼으면 j의 시작이 cut으로 내려오고, 왼쪽으로 옮겼으면 i의 시작이 cut으로 올라간다
+  __atomic_store_n(&s->shards[right ? j : i].lo, cut, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// shard i가 더 작은 이웃보다 지나치게 커졌으면 경계를 옮기는 함수
+// 이웃의 크기도 그 lock을 잡고 읽도록 i와 양옆 shard를 번호 순서대로 함께 잠근다.
+// 받은 쪽도 다시 그 이웃과 비교하므로 한쪽으로 몰린 key가 점차 옆 shard들로 퍼진다.
+static void shard_rebalance(rbtree_sharded *s, size_t i) {
+  for (;;) {
+    const size_t a = i > 0 ? i - 1 : i, b = i + 1 < s->n ? i + 1 : i;
+    for (size_t k = a; k <= b; k++)
+      pthread_mutex_lock(&s->shards[k].lock);
+    size_t j = a < i ? a : b;
+    if (b > i && s->shards[b].tree->count < s->shards[j].tree->count)
+      j = b;
+    int moved = 0;
+    if (j != i && s->shards[i].tree->count > 2 * s->shards[j].tree->count + SHARD_SLACK)
+      moved = shard_move(s, i, j);
+    s->shards[i].hold = shard_next_check(s->shards[i].tree);
+    for (size_t k = b + 1; k-- > a;)
+      pthread_mutex_unlock(&s->shards[k].lock);
+    if (!moved)
+      return;
+    i = j;
+  }
+}
+
+// key를 추가하는 함수 (실패하면 -1)
+int rbtree_sharded_insert(rbtree_sharded *s, const key_t key) {
+  const size_t i = shard_lock_key(s, key);
+  rbtree *t = s->shards[i].tree;
+  const int ok = rbtree_insert(t, key) != NULL;
+  const int grow = t->count > SHARD_SLACK && t->count > s->shards[i].hold;
+  pthread_mutex_unlock(&s->shards[i].lock);
+  if (grow)
+    shard_rebalance(s, i);
+  return ok ? 0 : -1;
+}
+
+// key를 가진 노드 하나를 삭제하는 함수 (삭제했으면 1, 없으면 0)
+int rbtree_sharded_erase(rbtree_sharded *s, const key_t key) {
+  const size_t i = shard_lock_key(s, key);
+  rbtree *t = s->shards[i].tree;
+  node_t *node = rbtree_find(t, key);
+  if (node != NULL)
+    rbtree_erase(t, node);
+  // 줄어든 뒤 다시 커질 때 너무 늦게 비교하지 않도록 다음 비교 시점도 낮춘다
+  if (s->shards[i].hold > shard_next_check(t))
+    s->shards[i].hold = shard_next_check(t);
+  pthread_mutex_unlock(&s->shards[i].lock);
+  return node != NULL;
+}
+
+// key가 있으면 1, 없으면 0을 반환하는 함수
+int rbtree_sharded_find(rbtree_sharded *s, const key_t key) {
+  const size_t i = shard_lock_key(s, key);
+  const int found = rbtree_find(s->shards[i].tree, key) != NULL;
+  pthread_mutex_unlock(&s->shards[i].lock);
+  return found;
+}
+
+static void shard_lock_all(rbtree_sharded *s) {
+  for (size_t i = 0; i < s->n; i++)
+    pthread_mutex_lock(&s->shards[i].lock);
+}
+
+static void shard_unlock_all(rbtree_sharded *s) {
+  for (size_t i = s->n; i-- > 0;)
+    pthread_mutex_unlock(&s->shards[i].lock);
+}
+
+// 가장 왼쪽(dir == 0) 또는 오른쪽 key를 찾는 함수
+// 끝 shard가 비어 있지 않으면 그 shard의 lock만으로 충분하고, 비어 있으면 모든 shard를 잠그고 찾는다.
+static int shard_edge(rbtree_sharded *s, const int dir, key_t *out) {
+  const size_t edge = dir == 0 ? 0 : s->n - 1;
+  rbtree_shard *sh = &s->shards[edge];
+  pthread_mutex_lock(&sh->lock);
+  node_t *x = dir == 0 ? rbtree_min(sh->tree) : rbtree_max(sh->tree);
+  if (x != NULL)
+    *out = x->key;
+  pthread_mutex_unlock(&sh->lock);
+  if (x != NULL)
+    return 1;
+
+  shard_lock_all(s);
+  for (size_t k = 0; k < s->n && x == NULL; k++) {
+    rbtree *t = s->shards[dir == 0 ? k : s->n - 1 - k].tree;
+    x = dir == 0 ? rbtree_min(t) : rbtree_max(t);
+  }
+  if (x != NULL)
+    *out = x->key;
+  shard_unlock_all(s);
+  return x != NULL;
+}
+
+// 최소 key를 *out에 저장하는 함수 (비어 있으면 0을 반환)
+int rbtree_sharded_min(rbtree_sharded *s, key_t *out) {
+  return shard_edge(s, 0, out);
+}
+
+// 최대 key를 *out에 저장하는 함수 (비어 있으면 0을 반환)
+int rbtree_sharded_max(rbtree_sharded *s, key_t *out) {
+  return shard_edge(s, 1, out);
+}
+
+// 전체 key 수를 반환하는 함수 (모든 shard를 잠근 시점의 값)
+size_t rbtree_sharded_size(rbtree_sharded *s) {
+  size_t cnt = 0;
+  shard_lock_all(s);
+  for (size_t i = 0; i < s->n; i++)
+    cnt += s->shards[i].tree->count;
+  shard_unlock_all(s);
+  return cnt;
+}
+
+// 모든 shard를 잠그고 key를 순서대로 최대 n개 저장한 뒤 저장한 개수를 반환하는 함수
+size_t rbtree_sharded_to_array(rbtree_sharded *s, key_t *arr, const size_t n) {
+  size_t cnt = 0;
+  shard_lock_all(s);
+  for (size_t i = 0; i < s->n && cnt < n; i++) {
+    rbtree_cursor cur;
+    rbtree_cursor_init(&cur, s->shards[i].tree);
+    cnt += rbtree_to_array_next(s->shards[i].tree, &cur, arr + cnt, n - cnt);
+  }
+  shard_unlock_all(s);
+  return cnt;
+}
+
+/* 16. copy-on-write 모드 (path copying + epoch 기반 회수) */
+// 쓰기는 루트에서 바뀌는 노드까지의 경로를 복사하고, 회전/재색칠되는 형제 노드도 복사해서 새 버전을 만든 뒤
+// 새 루트를 atomic하게 게시한다. 읽기는 잠그거나 재시도하지 않고 시작할 때 본 버전을 끝까지 읽는다.
+// 새 버전에서 빠진 노드는 그 노드를 볼 수 있었던 reader가 모두 끝난 뒤(epoch) 반환한다.
+// 복사본마다 자식들의 부모 포인터를 고칠 수는 없으므로 이 모드에서는 부모 포인터를 쓰지 않고 경로를 스택에 기억한다.
+#define COW_MAX_DEPTH 132                  // 높이 <= 2log2(n+1) <= 128, 삽입/회전으로 +2
+#define COW_MAX_FRESH (3 * COW_MAX_DEPTH)  // 쓰기 한 번에 새로 만드는 노드 수의 상한
+
+typedef struct {
+  _Alignas(64) unsigned long epoch;  // 0: 읽는 중이 아님, 그 외: 읽기 시작할 때의 전역 epoch
+  int used;                          // reader가 등록한 슬롯
+} cow_slot;
+
+typedef struct {
+  node_t *node;
+  unsigned long epoch;  // 새 버전에서 빠진 시점의 전역 epoch
+} cow_retired;
+
+struct rbtree_cow {
+  cow_slot slots[RBTREE_COW_READERS];
+  pthread_mutex_t lock;  // 쓰기 직렬화
+  unsigned long epoch;   // 전역 epoch (1부터 시작, 쓰기마다 1씩 증가)
+  cow_retired *retired;  // 회수를 기다리는 노드
+  size_t nretired, retired_cap;
+  node_t *spare[COW_MAX_FRESH];     // 쓰기 전에 미리 할당해 둔 노드 (쓰기 도중에는 할당이 실패하지 않도록)
+  size_t nspare;
+  node_t *fresh[COW_MAX_FRESH];     // 이번 쓰기에서 만든 노드 (아직 아무 reader도 보지 못했으므로 수정 가능)
+  size_t nfresh;
+  node_t *replaced[COW_MAX_FRESH + 1];  // 이번 쓰기로 새 버전에서 빠지는 노드 (복사된 노드와 z)
+  size_t nreplaced;
+};
+
+// 부모 포인터 없이 쓰는 copy-on-write 트리를 생성하는 함수
+rbtree *new_rbtree_cow(void) {
+  rbtree *t = new_rbtree_sized(0);
+  if (t == NULL)
+    return NULL;
+  rbtree_cow *c = (rbtree_cow *)aligned_alloc(_Alignof(rbtree_cow), sizeof(rbtree_cow));
+  if (c == NULL) {
+    delete_rbtree(t);
+    return NULL;
+  }
+  memset(c, 0, sizeof(rbtree_cow));
+  pthread_mutex_init(&c->lock, NULL);
+  c->epoch = 1;
+  t->cow = c;
+  return t;
+}
+
+// delete_rbtree에서 호출: 노드는 모두 arena에 있으므로 청크와 함께 해제된다
+static void cow_free(rbtree *t) {
+  pthread_mutex_destroy(&t->cow->lock);
+  free(t->cow->retired);
+  free(t->cow);
+  t->cow = NULL;
+}
+
+// reader 슬롯을 하나 등록하고 번호를 반환하는 함수 (모두 사용 중이면 -1)
+int rbtree_cow_reader_add(rbtree *t) {
+  for (int i = 0; i < RBTREE_COW_READERS; i++) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&t->cow->slots[i].used, &expected, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return i;
+  }
+  return -1;
+}
+
+void rbtree_cow_reader_remove(rbtree *t, const int slot) {
+  __atomic_store_n(&t->cow->slots[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+// 읽기 구간을 시작하는 함수: 이후 읽은 노드는 rbtree_cow_read_unlock 전까지 반환되지 않는다
+void rbtree_cow_read_lock(const rbtree *t, const int slot) {
+  rbtree_cow *c = t->cow;
+  __atomic_store_n(&c->slots[slot].epoch, __atomic_load_n(&c->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+  // 슬롯 기록이 루트 읽기보다 먼저 보여야 writer가 이 reader를 놓치지 않는다
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rbtree_cow_read_unlock(const rbtree *t, const int slot) {
+  __atomic_store_n(&t->cow->slots[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+// 회수를 기다리는 노드 수를 반환하는 함수
+size_t rbtree_cow_retired(const rbtree *t) {
+  return t->cow->nretired;
+}
+
+// 쓰기 한 번에 필요한 노드와 회수 목록 공간을 미리 확보하는 함수 (실패하면 -1)
+// 높이 h인 트리에서 경로 복사는 h+1개, fixup에서 복사하는 형제는 최대 2h+4개이다.
+static int cow_reserve(rbtree *t) {
+  rbtree_cow *c = t->cow;
+  size_t h = 2;
+  for (size_t n = t->count + 1; n > 1; n >>= 1)
+    h += 2;
+  const size_t need = 3 * h + 5 < COW_MAX_FRESH ? 3 * h + 5 : COW_MAX_FRESH;
+  while (c->nspare < need) {
+    node_t *x = node_alloc(t);
+    if (x == NULL)
+      return -1;
+    c->spare[c->nspare++] = x;
+  }
+  if (c->retired_cap < c->nretired + COW_MAX_FRESH + 1) {
+    const size_t cap = 2 * c->retired_cap + COW_MAX_FRESH + 1;
+    cow_retired *r = (cow_retired *)realloc(c->retired, cap * sizeof(cow_retired));
+    if (r == NULL)
+      return -1;
+    c->retired = r;
+    c->retired_cap = cap;
+  }
+  c->nfresh = c->nreplaced = 0;
+  return 0;
+}
+
+static node_t *cow_alloc(rbtree *t) {
+  rbtree_cow *c = t->cow;
+  node_t *x = c->spare[--c->nspare];
+  c->fresh[c->nfresh++] = x;
+  return x;
+}
+
+static int cow_is_fresh(const rbtree *t, const node_t *x) {
+  for (size_t i = 0; i < t->cow->nfresh; i++)
+    if (t->cow->fresh[i] == x)
+      return 1;
+  return 0;
+}
+
+// x를 새 버전에서 빼고 수정 가능한 복사본을 반환하는 함수
+static node_t *cow_copy(rbtree *t, node_t *x) {
+  node_t *y = cow_alloc(t);
+  memcpy(y, x, t->node_size);
+  t->cow->replaced[t->cow->nreplaced++] = x;
+  return y;
+}
+
+// 새 버전의 부모 p(nil이면 루트)의 dir쪽 자식을 c로 바꾸는 함수
+static void cow_set_child(rbtree *t, node_t **root, node_t *p, const int dir, node_t *c) {
+  if (p == t->nil)
+    *root = c;
+  else if (dir == 0)
+    SET_LEFT(p, c);
+  else
+    SET_RIGHT(p, c);
+}
+
+// 수정 가능한 노드 p의 dir쪽 자식을 수정 가능하게 만들어 반환하는 함수
+static node_t *cow_own(rbtree *t, node_t *p, const int dir) {
+  node_t *x = dir == 0 ? LEFT(p) : RIGHT(p);
+  if (x == t->nil || cow_is_fresh(t, x))
+    return x;
+  x = cow_copy(t, x);
+  cow_set_child(t, NULL, p, dir, x);
+  return x;
+}
+
+// x를 dir 방향으로 회전하는 함수 (dir == 0: 왼쪽), p는 x의 부모 (x와 올라오는 자식은 수정 가능해야 한다)
+static void cow_rotate(rbtree *t, node_t **root, node_t *p, node_t *x, const int dir) {
+  STAT_INC(t, rotations);
+  node_t *y;
+  if (dir == 0) {
+    y = RIGHT(x);
+    SET_RIGHT(x, LEFT(y));
+    SET_LEFT(y, x);
+  } else {
+    y = LEFT(x);
+    SET_LEFT(x, RIGHT(y));
+    SET_RIGHT(y, x);
+  }
+  cow_set_child(t, root, p, p != t->nil && RIGHT(p) == x, y);
+#ifdef RBTREE_ORDER_STAT
+  y->size = x->size;
+  x->size = LEFT(x)->size + RIGHT(x)->size + COPIES(x);
+#endif
+}
+
+// 만든 버전을 게시하고, 빠진 노드를 회수 목록에 넣은 뒤 더 이상 아무도 볼 수 없는 노드를 반환하는 함수
+static void cow_publish(rbtree *t, node_t *root) {
+  rbtree_cow *c = t->cow;
+  __atomic_store_n(&t->root, root, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < c->nreplaced; i++)
+    c->retired[c->nretired++] = (cow_retired){c->replaced[i], c->epoch};
+
+  // epoch e에 빠진 노드는 e 이하의 epoch에서 읽기 시작한 reader만 볼 수 있다
+  __atomic_store_n(&c->epoch, c->epoch + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  unsigned long min = c->epoch;
+  for (int i = 0; i < RBTREE_COW_READERS; i++) {
+    const unsigned long e = __atomic_load_n(&c->slots[i].epoch, __ATOMIC_ACQUIRE);
+    if (e != 0 && e < min)
+      min = e;
+  }
+  size_t keep = 0;
+  for (size_t i = 0; i < c->nretired; i++) {
+    if (c->retired[i].epoch < min)
+      node_free(t, c->retired[i].node);
+    else
+      c->retired[keep++] = c->retired[i];
+  }
+  c->nretired = keep;
+}
+
+// 삽입 경로 path[0..n-1] (path[n-1]이 새 노드)를 따라 균형을 복구하는 함수
+static void cow_insert_fixup(rbtree *t, node_t **root, node_t **path, size_t i) {
+  while (i > 0 && COLOR(path[i - 1]) == RBTREE_RED) {
+    STAT_INC(t, insert_fixups);
+    node_t *p = path[i - 1], *g = path[i - 2];
+    node_t *gg = i >= 3 ? path[i - 3] : t->nil;
+    const int side = p == LEFT(g) ? 0 : 1;  // p가 g의 어느 쪽 자식인지
+    node_t *y = side == 0 ? RIGHT(g) : LEFT(g);
+    if (COLOR(y) == RBTREE_RED) {
+      y = cow_own(t, g, !side);
+      RECOLOR(t, p, RBTREE_BLACK);
+      RECOLOR(t, y, RBTREE_BLACK);
+      RECOLOR(t, g, RBTREE_RED);
+      i -= 2;
+      continue;
+    }
+    node_t *z = path[i];
+    if (z == (side == 0 ? RIGHT(p) : LEFT(p))) {
+      cow_rotate(t, root, g, p, side);
+      p = z;
+    }
+    RECOLOR(t, p, RBTREE_BLACK);
+    RECOLOR(t, g, RBTREE_RED);
+    cow_rotate(t, root, gg, g, !side);
+    break;
+  }
+  if (COLOR(*root) != RBTREE_BLACK)
+    RECOLOR(t, *root, RBTREE_BLACK);
+}
+
+// copy-on-write 삽입: 루트에서 새 노드의 부모까지 복사하고 복사본 위에서 균형을 복구한다
+// unique가 1이면 같은 key의 노드가 있을 때 아무것도 바꾸지 않고 그 노드를 반환한다.
+// 같은 key를 찾는 것도 쓰기 lock 안에서 한 번 내려가며 하므로 두 writer가 같은 key를 함께 추가할 수 없다.
+static node_t *cow_insert(rbtree *t, const key_t key, const int unique, int *inserted) {
+  rbtree_cow *c = t->cow;
+  *inserted = 0;
+  pthread_mutex_lock(&c->lock);
+
+  // 먼저 원본 트리에서 경로만 기억하며 내려가고, 실제로 바꿀 때만 복사한다
+  node_t *path[COW_MAX_DEPTH];
+  unsigned char dirs[COW_MAX_DEPTH];
+  size_t n = 0;
+  node_t *x = t->root;
+#ifdef RBTREE_COUNTED
+  int found = 0;
+#endif
+  while (x != t->nil) {
+    path[n] = x;
+    if (x->key == key) {
+      if (unique) {
+        pthread_mutex_unlock(&c->lock);
+        return x;
+      }
+#ifdef RBTREE_COUNTED
+      // 같은 key의 노드는 복사본의 개수만 늘린다
+      if (x->copies < RBTREE_MAX_COPIES) {
+        found = 1;
+        n++;
+        break;
+      }
+#endif
+    }
+    dirs[n] = x->key > key ? 0 : 1;
+    x = dirs[n++] == 0 ? LEFT(x) : RIGHT(x);
+  }
+
+  if (cow_reserve(t) != 0) {
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+  }
+  node_t *root = t->root, *p = t->nil;
+  for (size_t i = 0; i < n; i++) {
+    x = cow_copy(t, path[i]);
+    cow_set_child(t, &root, p, i == 0 ? 0 : dirs[i - 1], x);
+#ifdef RBTREE_ORDER_STAT
+    x->size++;
+#endif
+    path[i] = p = x;
+  }
+#ifdef RBTREE_COUNTED
+  if (found) {
+    x->copies++;
+    t->count++;
+    cow_publish(t, root);
+    pthread_mutex_unlock(&c->lock);
+    *inserted = 1;
+    return x;
+  }
+#endif
+
+  node_t *z = cow_alloc(t);
+  z->key = key;
+  SET_PARENT(z, t->nil);
+  SET_LEFT(z, t->nil);
+  SET_RIGHT(z, t->nil);
+  SET_COLOR(z, RBTREE_RED);
+#ifdef RBTREE_COUNTED
+  z->copies = 1;
+#endif
+#ifdef RBTREE_ORDER_STAT
+  z->size = 1;
+#endif
+  cow_set_child(t, &root, p, n == 0 ? 0 : dirs[n - 1], z);
+  path[n++] = z;
+  cow_insert_fixup(t, &root, path, n - 1);
+
+  t->count++;
+  cow_publish(t, root);
+  pthread_mutex_unlock(&c->lock);
+  *inserted = 1;
+  return z;
+}
+
+// x에서 z까지 내려가는 방향을 dirs에 기록하고 z의 깊이를 반환하는 함수 (없으면 -1)
+// 같은 key가 여러 개면 z가 어느 쪽에 있는지 모르므로 양쪽을 모두 찾아본다.
+static int cow_locate(const rbtree *t, const node_t *x, const node_t *z, unsigned char *dirs, const int depth) {
+  if (x == t->nil || depth == COW_MAX_DEPTH)
+    return -1;
+  if (x == z)
+    return depth;
+  if (z->key != x->key) {
+    dirs[depth] = z->key > x->key;
+    return cow_locate(t, dirs[depth] ? RIGHT(x) : LEFT(x), z, dirs, depth + 1);
+  }
+  dirs[depth] = 0;
+  const int found = cow_locate(t, LEFT(x), z, dirs, depth + 1);
+  if (found >= 0)
+    return found;
+  dirs[depth] = 1;
+  return cow_locate(t, RIGHT(x), z, dirs, depth + 1);
+}
+
+// 검은 노드가 빠진 자리 x(부모는 path[n-1])에서 균형을 복구하는 함수 (rbtree_erase_fixup과 같은 경우 분류)
+static void cow_erase_fixup(rbtree *t, node_t **root, node_t **path, size_t n, node_t *x) {
+  while (x != *root && COLOR(x) == RBTREE_BLACK) {
+    STAT_INC(t, erase_fixups);
+    node_t *xp = path[n - 1];
+    node_t *g = n >= 2 ? path[n - 2] : t->nil;
+    const int side = x == LEFT(xp) ? 0 : 1;  // x가 xp의 어느 쪽 자식인지
+    node_t *w = cow_own(t, xp, !side);
+    if (COLOR(w) == RBTREE_RED) {
+      RECOLOR(t, w, RBTREE_BLACK);
+      RECOLOR(t, xp, RBTREE_RED);
+      cow_rotate(t, root, g, xp, side);
+      path[n - 1] = w;  // w가 xp의 부모가 되었으므로 경로에 끼워 넣는다
+      path[n++] = xp;
+      g = w;
+      w = cow_own(t, xp, !side);
+    }
+    if (COLOR(LEFT(w)) == RBTREE_BLACK && COLOR(RIGHT(w)) == RBTREE_BLACK) {
+      RECOLOR(t, w, RBTREE_RED);
+      x = xp;
+      n--;
+      continue;
+    }
+    if (COLOR(side == 0 ? RIGHT(w) : LEFT(w)) == RBTREE_BLACK) {
+      node_t *near = cow_own(t, w, side);
+      RECOLOR(t, near, RBTREE_BLACK);
+      RECOLOR(t, w, RBTREE_RED);
+      cow_rotate(t, root, xp, w, !side);
+      w = near;
+    }
+    RECOLOR(t, w, COLOR(xp));
+    RECOLOR(t, xp, RBTREE_BLACK);
+    RECOLOR(t, cow_own(t, w, !side), RBTREE_BLACK);
+    cow_rotate(t, root, g, xp, side);
+    x = *root;
+  }
+  if (x != t->nil && COLOR(x) != RBTREE_BLACK)
+    RECOLOR(t, x, RBTREE_BLACK);
+}
+
+// copy-on-write 삭제: z와 후속 노드까지의 경로를 복사하고 복사본 위에서 떼어낸 뒤 균형을 복구한다
+// z가 현재 버전에 없으면 -1을 반환한다.
+static int cow_erase(rbtree *t, node_t *z) {
+  rbtree_cow *c = t->cow;
+  unsigned char dirs[COW_MAX_DEPTH];
+  pthread_mutex_lock(&c->lock);
+  const int d = cow_locate(t, t->root, z, dirs, 0);
+  if (d < 0 || cow_reserve(t) != 0) {
+    pthread_mutex_unlock(&c->lock);
+    return -1;
+  }
+
+  // z의 조상을 복사한다 (z 자신은 새 버전에 남지 않으므로 복사하지 않음)
+  node_t *path[COW_MAX_DEPTH];
+  size_t n = 0;
+  node_t *root = t->root, *zp = t->nil, *x = root;
+  for (int i = 0; i < d; i++) {
+    x = cow_copy(t, x);
+    cow_set_child(t, &root, zp, i > 0 ? dirs[i - 1] : 0, x);
+    path[n++] = zp = x;
+    x = dirs[i] ? RIGHT(x) : LEFT(x);
+  }
+  const int zdir = d > 0 ? dirs[d - 1] : 0;
+#ifdef RBTREE_COUNTED
+  // 같은 key가 여러 개 있는 노드는 z까지 복사해 개수만 줄인다
+  if (z->copies > 1) {
+    x = cow_copy(t, z);
+    cow_set_child(t, &root, zp, zdir, x);
+    x->copies--;
+#ifdef RBTREE_ORDER_STAT
+    x->size--;
+    for (size_t i = 0; i < n; i++)
+      path[i]->size--;
+#endif
+    t->count--;
+    cow_publish(t, root);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+  }
+#endif
+  c->replaced[c->nreplaced++] = z;
+
+  color_t y_original_color = COLOR(z);
+  node_t *y = z;
+  if (LEFT(z) == t->nil || RIGHT(z) == t->nil) {
+    x = LEFT(z) == t->nil ? RIGHT(z) : LEFT(z);
+    cow_set_child(t, &root, zp, zdir, x);
+  } else {
+    // 후속 노드 y(오른쪽 서브트리의 최소)까지 복사해 y로 z를 대신한다
+    node_t *r = RIGHT(z);
+    size_t ny = n++;  // path[ny]에 y가 들어간다
+    if (LEFT(r) == t->nil) {
+      y = cow_copy(t, r);
+      x = RIGHT(y);
+    } else {
+      node_t *cur = cow_copy(t, r);
+      path[n++] = cur;
+      node_t *sub = cur;
+      while (LEFT(LEFT(cur)) != t->nil) {
+        node_t *next = cow_copy(t, LEFT(cur));
+        SET_LEFT(cur, next);
+        path[n++] = cur = next;
+      }
+      y = cow_copy(t, LEFT(cur));
+      x = RIGHT(y);
+      SET_LEFT(cur, x);
+      SET_RIGHT(y, sub);
+    }
+    y_original_color = COLOR(y);
+    SET_LEFT(y, LEFT(z));
+    SET_COLOR(y, COLOR(z));
+#ifdef RBTREE_ORDER_STAT
+    y->size = z->size;
+#endif
+    cow_set_child(t, &root, zp, zdir, y);
+    path[ny] = y;
+  }
+#ifdef RBTREE_ORDER_STAT
+  // z의 조상과 y는 z의 개수만큼, y가 빠져나온 경로는 y의 개수만큼 줄어든다
+  for (size_t i = 0; i < n; i++)
+    path[i]->size -= i <= (size_t)d ? COPIES(z) : COPIES(y);
+#endif
+
+  if (y_original_color == RBTREE_BLACK) {
+    // 색을 칠할 수도 있으므로 x도 수정 가능하게 만든다
+    if (x != t->nil && n == 0)
+      x = root = cow_copy(t, x);
+    else if (x != t->nil)
+      x = cow_own(t, path[n - 1], RIGHT(path[n - 1]) == x);
+    cow_erase_fixup(t, &root, path, n, x);
+  }
+
+  t->count -= COPIES(z);
+  cow_publish(t, root);
+  pthread_mutex_unlock(&c->lock);
+  return 0;
+}
+
+// 루트부터 스택으로 중위 순회하며 key를 최대 n개 저장하는 함수 (부모 포인터를 쓰지 않음)
+static size_t cow_to_array(const rbtree *t, key_t *arr, const size_t n) {
+  node_t *stack[COW_MAX_DEPTH];
+  size_t top = 0, i = 0;
+  node_t *x = ROOT(t);
+  while (i < n && (x != t->nil || top > 0)) {
+    while (x != t->nil) {
+      stack[top++] = x;
+      x = LEFT(x);
+    }
+    x = stack[--top];
+    for (size_t c = COPIES(x); c > 0 && i < n; c--)
+      arr[i++] = x->key;
+    x = RIGHT(x);
+  }
+  return i;
+}
+
+/* 17. 스냅샷과 스택 반복자 */
+// copy-on-write 트리의 현재 버전을 O(1)에 고정하는 함수 (copy-on-write 트리가 아니거나 슬롯이 없으면 NULL)
+// 스냅샷은 reader 슬롯 하나를 계속 잡고 있으므로, 이후 쓰기로 빠진 노드는 스냅샷을 놓을 때까지 회수되지 않는다.
+rbtree_snapshot_t *rbtree_snapshot(rbtree *t) {
+  if (t->cow == NULL)
+    return NULL;
+  rbtree_snapshot_t *snap = (rbtree_snapshot_t *)malloc(sizeof(rbtree_snapshot_t));
+  if (snap == NULL)
+    return NULL;
+  snap->slot = rbtree_cow_reader_add(t);
+  if (snap->slot < 0) {
+    free(snap);
+    return NULL;
+  }
+  snap->tree = t;
+  // 루트와 노드 수가 같은 버전이 되도록 쓰기 사이에서 고정한다
+  pthread_mutex_lock(&t->cow->lock);
+  rbtree_cow_read_lock(t, snap->slot);
+  snap->view = *t;
+  pthread_mutex_unlock(&t->cow->lock);
+  return snap;
+}
+
+// 스냅샷의 읽기 전용 트리를 반환하는 함수
+// rbtree_find, rbtree_min, rbtree_max, rbtree_lower_bound, rbtree_to_array, rbtree_iter_init 등에 넘길 수 있다.
+const rbtree *rbtree_snapshot_view(const rbtree_snapshot_t *snap) {
+  return &snap->view;
+}
+
+// 스냅샷을 놓는 함수 (이후 쓰기에서 스냅샷만 보던 노드가 회수된다)
+void rbtree_snapshot_release(rbtree_snapshot_t *snap) {
+  rbtree_cow_read_unlock(snap->tree, snap->slot);
+  rbtree_cow_reader_remove(snap->tree, snap->slot);
+  free(snap);
+}
+
+// 부모 포인터 없이 key 순서로 순회하는 반복자를 시작하는 함수 (모든 트리에서 사용 가능)
+void rbtree_iter_init(rbtree_iter *it, const rbtree *t) {
+  it->tree = t;
+  it->top = 0;
+  for (node_t *x = ROOT(t); x != t->nil; x = LEFT(x))
+    it->stack[it->top++] = x;
+}
+
+// 다음 노드를 반환하는 함수 (끝이면 NULL)
+node_t *rbtree_iter_next(rbtree_iter *it) {
+  if (it->top == 0)
+    return NULL;
+  node_t *x = it->stack[--it->top];
+  for (node_t *y = RIGHT(x); y != it->tree->nil; y = LEFT(y))
+    it->stack[it->top++] = y;
+  return x;
+}
+
+/* 18. 분할과 결합 (split / join) */
+// (RBTREE_TOPDOWN 빌드는 결합 뒤의 균형 복구에 부모 포인터가 필요해 rbtree_erase_range만 남긴다)
+#ifndef RBTREE_TOPDOWN
+// 두 트리를 합칠 때는 black-height가 높은 쪽의 가장자리를 따라 낮은 쪽과 black-height가 같은 검은 노드까지 내려가
+// 그 자리에 빨간 pivot 노드를 끼우고 rbtree_insert_fixup으로 빨강-빨강 위반만 고친다.
+// 내려가는 거리는 두 black-height의 차이에 비례하므로, 분할 중 반복되는 결합의 비용은 모두 합쳐 O(log n)이다.
+
+// 루트에서 왼쪽 끝까지 내려가며 black-height를 구하는 함수 (nil은 0)
+static int black_height(const rbtree *t, node_t *x) {
+  int h = 0;
+  for (; x != t->nil; x = LEFT(x))
+    if (COLOR(x) == RBTREE_BLACK)
+      h++;
+  return h;
+}
+
+// black-height가 h인 서브트리 x를 독립된 트리로 떼어내고, 루트를 검정으로 칠한 뒤의 black-height를 반환하는 함수
+static int detach_subtree(rbtree *t, node_t *x, int h) {
+  if (x == t->nil)
+    return 0;
+  SET_PARENT(x, t->nil);
+  if (COLOR(x) == RBTREE_RED) {
+    SET_COLOR(x, RBTREE_BLACK);
+    h++;
+  }
+  return h;
+}
+
+// 검은 루트 l(black-height hl), 노드 k, 검은 루트 r(hr)을 합친 트리의 루트를 반환하는 함수 (l의 key <= k <= r의 key)
+// *h에는 합친 트리의 black-height를 기록한다.
+static node_t *join_nodes(rbtree *t, node_t *l, const int hl, node_t *k, node_t *r, const int hr, int *h) {
+  const int right = hl >= hr;  // 1: l의 오른쪽 가장자리를 따라 내려간다
+  const int target = right ? hr : hl;
+  int ch = right ? hl : hr;
+  node_t *cur = right ? l : r, *parent = t->nil;
+  node_t *other = right ? r : l;
+  rbtree sub = *t;  // rbtree_insert_fixup과 회전은 sub.root를 갱신한다
+  sub.root = cur;
+
+  while (COLOR(cur) != RBTREE_BLACK || ch != target) {
+    if (COLOR(cur) == RBTREE_BLACK)
+      ch--;
+    parent = cur;
+    cur = right ? RIGHT(cur) : LEFT(cur);
+  }
+
+  SET_PARENT(k, parent);
+  SET_COLOR(k, RBTREE_RED);
+  SET_LEFT(k, right ? cur : other);
+  SET_RIGHT(k, right ? other : cur);
+  if (cur != t->nil)
+    SET_PARENT(cur, k);
+  if (other != t->nil)
+    SET_PARENT(other, k);
+  if (parent == t->nil)
+    sub.root = k;
+  else if (right)
+    SET_RIGHT(parent, k);
+  else
+    SET_LEFT(parent, k);
+#ifdef RBTREE_ORDER_STAT
+  k->size = LEFT(k)->size + RIGHT(k)->size + COPIES(k);
+  for (node_t *p = parent; p != t->nil; p = PARENT(p))
+    p->size += other->size + COPIES(k);
+#endif
+  rbtree_insert_fixup(&sub, k);
+
+  // k의 두 서브트리는 black-height가 target이므로, 여기에 k부터 루트까지의 검은 노드 수를 더한다
+  int bh = target;
+  for (node_t *p = k; p != t->nil; p = PARENT(p))
+    if (COLOR(p) == RBTREE_BLACK)
+      bh++;
+  *h = bh;
+  return sub.root;
+}
+
+// black-height가 h인 서브트리 x를 key 미만(*l)과 key 이상(*r)으로 나누는 함수 (upto면 key 이하와 key 초과)
+// 루트에서 key 쪽으로 내려가며, 반대편 서브트리는 지나친 노드를 pivot으로 삼아 결과에 결합한다.
+static void split_nodes(rbtree *t, node_t *x, const int h, const key_t key, const int upto,
+                        node_t **l, int *hl, node_t **r, int *hr) {
+  if (x == t->nil) {
+    *l = *r = t->nil;
+    *hl = *hr = 0;
+    return;
+  }
+  const int hc = h - (COLOR(x) == RBTREE_BLACK);
+  node_t *a = LEFT(x), *b = RIGHT(x);
+  const int ha = detach_subtree(t, a, hc);
+  const int hb = detach_subtree(t, b, hc);
+  node_t *part;
+  int hp;
+  if (upto ? key < x->key : key <= x->key) {
+    split_nodes(t, a, ha, key, upto, l, hl, &part, &hp);
+    *r = join_nodes(t, part, hp, x, b, hb, hr);
+  } else {
+    split_nodes(t, b, hb, key, upto, &part, &hp, r, hr);
+    *l = join_nodes(t, a, ha, x, part, hp, hl);
+  }
+}
+
+// l의 key <= r의 key인 두 서브트리를 r의 최소 노드를 pivot으로 삼아 붙이는 함수
+static node_t *concat_nodes(rbtree *t, node_t *l, const int hl, node_t *r, const int hr, int *h) {
+  if (r == t->nil || l == t->nil) {
+    *h = r == t->nil ? hl : hr;
+    return r == t->nil ? l : r;
+  }
+  rbtree sub = *t;
+  sub.root = r;
+  node_t *k = subtree_min(&sub, r);
+  detach_node(&sub, k);
+  return join_nodes(t, l, hl, k, sub.root, black_height(&sub, sub.root), h);
+}
+
+// 나뉜 두 트리의 노드 수를 정하는 함수
+// 순서 통계 빌드는 루트의 서브트리 크기로 O(1), 그 외에는 두 트리를 번갈아 세어 작은 쪽 크기만큼만 순회한다.
+static void split_count(rbtree *l, rbtree *r, const size_t total) {
+#ifdef RBTREE_ORDER_STAT
+  l->count = l->root->size;
+#else
+  rbtree_iter a, b;
+  rbtree_iter_init(&a, l);
+  rbtree_iter_init(&b, r);
+  size_t ca = 0, cb = 0;
+  for (;;) {
+    node_t *x = rbtree_iter_next(&a);
+    if (x == NULL) {
+      l->count = ca;
+      break;
+    }
+    ca += COPIES(x);
+    node_t *y = rbtree_iter_next(&b);
+    if (y == NULL) {
+      l->count = total - cb;
+      break;
+    }
+    cb += COPIES(y);
+  }
+#endif
+  r->count = total - l->count;
+}
+
+// t를 key 미만인 *left와 key 이상인 *right로 나누는 함수 (실패하면 -1)
+// 노드는 옮기기만 하고 새로 할당하지 않으며, t는 *left가 된다. 두 트리는 같은 arena를 함께 쓴다.
+int rbtree_split(rbtree *t, const key_t key, rbtree **left, rbtree **right) {
+  if (t->cow != NULL)
+    return -1;
+  rbtree *r = (rbtree *)malloc(sizeof(rbtree));
+  if (r == NULL)
+    return -1;
+  *r = *t;
+#ifdef RBTREE_STATS
+  r->stats = (rbtree_stats *)calloc(1, sizeof(rbtree_stats));
+#endif
+  if (t->arena != NULL)
+    t->arena->refs++;
+
+  int hl, hr;
+  split_nodes(t, t->root, black_height(t, t->root), key, 0, &t->root, &hl, &r->root, &hr);
+  split_count(t, r, t->count);
+  t->rightmost = r->rightmost = NULL;
+  *left = t;
+  *right = r;
+  return 0;
+}
+
+// src arena의 청크와 free list를 dst로 옮기고 src를 해제하는 함수
+// 비용은 src의 청크 수와 free list 길이에 비례한다.
+static void arena_absorb(rbtree *t, rbtree_arena *dst, rbtree_arena *src) {
+  if (src->chunks != NULL) {
+    arena_chunk *tail = src->chunks;
+    while (tail->next != NULL)
+      tail = tail->next;
+    // dst의 첫 청크는 아직 채우는 중이므로 그 뒤에 끼운다
+    if (dst->chunks == NULL) {
+      dst->chunks = src->chunks;
+      dst->used = src->used;
+    } else {
+      tail->next = dst->chunks->next;
+      dst->chunks->next = src->chunks;
+    }
+  }
+  if (src->free_list != NULL) {
+    node_t *tail = src->free_list;
+    while (LEFT(tail) != t->nil)
+      tail = LEFT(tail);
+    SET_LEFT(tail, dst->free_list == NULL ? t->nil : dst->free_list);
+    dst->free_list = src->free_list;
+  }
+  free(src);
+}
+
+// 결합할 두 트리가 같은 arena를 쓰도록 맞추는 함수 (둘 다 다른 트리와 공유 중이면 -1)
+static int arena_join(rbtree *l, rbtree *r) {
+  rbtree_arena *a = l->arena, *b = r->arena;
+  if (a == b) {
+    if (a != NULL)
+      a->refs--;  // r이 사라지므로
+  } else if (b->refs == 1) {
+    arena_absorb(l, a, b);
+  } else if (a->refs == 1) {
+    arena_absorb(l, b, a);
+    l->arena = b;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+// left, pivot, right를 하나의 트리로 합쳐 반환하는 함수 (left의 key <= pivot <= right의 key)
+// pivot은 NULL(right의 최소 노드를 사용)이거나 rbtree_max(left) 또는 rbtree_min(right)이어야 한다.
+// 노드는 옮기기만 하며, 결과는 left 구조체를 재사용하고 right 구조체는 해제된다.
+// 두 트리의 노드 저장 방식이 다르면(malloc/arena, 맵 값 크기, intrusive, copy-on-write) NULL을 반환하고 아무것도 바꾸지 않는다.
+rbtree *rbtree_join(rbtree *left, node_t *pivot, rbtree *right) {
+  if (left->cow != NULL || right->cow != NULL || left->intrusive != right->intrusive ||
+      left->node_size != right->node_size || (left->arena == NULL) != (right->arena == NULL))
+    return NULL;
+  rbtree *owner = right;
+  if (pivot == NULL)
+    pivot = rbtree_min(right);
+  else if (pivot == rbtree_max(left))
+    owner = left;
+  else if (pivot != rbtree_min(right))
+    return NULL;
+  if (arena_join(left, right) != 0)
+    return NULL;
+
+#ifdef RBTREE_COUNTED
+  // 경계의 같은 key는 한 노드로 합친다 (intrusive 트리의 링크는 호출한 쪽 메모리이므로 그대로 둔다)
+  node_t *lmax = rbtree_max(left), *rmin = rbtree_min(right);
+  if (!left->intrusive && lmax != NULL && rmin != NULL && lmax->key == rmin->key &&
+      COPIES(lmax) + COPIES(rmin) <= RBTREE_MAX_COPIES) {
+    const size_t c = COPIES(rmin);
+    detach_node(right, rmin);
+    node_free(left, rmin);  // right의 arena는 이미 left의 arena로 합쳐졌다
+    copies_change(left, lmax, c);
+    if (pivot == rmin)
+      pivot = rbtree_min(right);
+  }
+#endif
+  if (pivot != NULL) {
+    detach_node(owner, pivot);
+    int h;
+    left->root = join_nodes(left, left->root, black_height(left, left->root), pivot,
+                            right->root, black_height(right, right->root), &h);
+    left->count += right->count + COPIES(pivot);
+  }
+  left->rightmost = NULL;
+#ifdef RBTREE_STATS
+  free(right->stats);
+#endif
+  free(right);
+  return left;
+}
+
+// 서브트리 x의 노드를 모두 반환하고 key 수를 반환하는 함수 (오른쪽으로 회전해 펴 가며 스택 없이 순회)
+// intrusive 트리의 노드는 호출한 쪽 메모리이므로 떼어내기만 한다.
+static size_t free_subtree(rbtree *t, node_t *x) {
+  size_t n = 0;
+  while (x != t->nil) {
+    node_t *l = LEFT(x);
+    if (l == t->nil) {
+      node_t *r = RIGHT(x);
+      n += COPIES(x);
+      if (!t->intrusive)
+        node_free(t, x);
+      x = r;
+    } else {
+      SET_LEFT(x, RIGHT(l));
+      SET_RIGHT(l, x);
+      x = l;
+    }
+  }
+  return n;
+}
+#endif
+
+// [lo, hi) 범위의 key를 모두 삭제하고 삭제한 key 수를 반환하는 함수
+// 범위를 두 번의 분할로 통째로 떼어낸 뒤 나머지 두 트리를 결합하므로, 균형 복구는 k번이 아니라 O(log n)이고
+// 떼어낸 k개의 노드는 반환만 한다 (O(log n + k)). copy-on-write 트리와 RBTREE_TOPDOWN 빌드는 노드를 하나씩 삭제한다.
+size_t rbtree_erase_range(rbtree *t, const key_t lo, const key_t hi) {
+  if (!(lo < hi))
+    return 0;
+  size_t erased = 0;
+#ifndef RBTREE_TOPDOWN
+  if (t->cow == NULL) {
+    node_t *l, *m, *mid, *r;
+    int hl, hm, hmid, hr, h;
+    split_nodes(t, t->root, black_height(t, t->root), lo, 0, &l, &hl, &m, &hm);
+    split_nodes(t, m, hm, hi, 0, &mid, &hmid, &r, &hr);
+    t->root = concat_nodes(t, l, hl, r, hr, &h);
+    erased = free_subtree(t, mid);
+    t->count -= erased;
+    t->rightmost = NULL;  // 최대 노드가 범위에 있었을 수 있다
+    return erased;
+  }
+#endif
+
+  for (node_t *x = rbtree_lower_bound(t, lo); x != NULL && x->key < hi; x = rbtree_lower_bound(t, lo)) {
+    rbtree_erase(t, x);
+    erased++;
+  }
+  return erased;
+}
+
+/* 19. 병렬 집합 연산 (union / intersection / difference) */
+#ifndef RBTREE_TOPDOWN
+// a의 루트 key로 두 트리를 나눠 key보다 작은 쪽끼리, 큰 쪽끼리 재귀로 처리한 뒤 join_nodes로 다시 붙인다.
+// 나누기와 붙이기가 모두 O(log n)이므로 작업량은 O(m log(n/m + 1))이고 (m <= n),
+// 서로 겹치지 않는 서브트리 쌍은 작업 훔치기(work stealing) 스레드 풀에서 병렬로 처리한다.
+// 중복 key는 multiset으로 다룬다: 합집합은 두 트리의 노드를 모두 남기고,
+// 교집합은 key마다 min(a의 개수, b의 개수)개, 차집합은 max(a의 개수 - b의 개수, 0)개의 a 노드를 남긴다.
+#define SETOP_GRAIN 6        // 두 서브트리의 black-height가 모두 이 이하이면 나누지 않고 한 스레드에서 처리
+#define SETOP_DEQUE_CAP 256  // 한 작업자가 내놓는 작업은 재귀 깊이(<= 2 * black-height)를 넘지 않는다
+
+enum { SETOP_UNION, SETOP_INTERSECT, SETOP_DIFFERENCE };
+
+// 처리할 서브트리 쌍과 그 결과
+typedef struct {
+  node_t *a, *b;
+  int ha, hb;
+  node_t *res;
+  int hres;
+  int done;
+} setop_task;
+
+typedef struct setop_pool setop_pool;
+
+typedef struct {
+  setop_pool *pool;
+  rbtree t;               // 작업자 전용 트리 사본 (회전이 바꾸는 루트와 카운터를 스레드끼리 공유하지 않도록)
+  pthread_mutex_t lock;   // deque 보호
+  setop_task *deque[SETOP_DEQUE_CAP];
+  int top, bottom;        // 다른 작업자는 top에서 훔치고, 주인은 bottom에서 넣고 뺀다
+  node_t *garbage;        // 결과에서 빠진 노드 (left로 연결, 연산이 끝난 뒤 한꺼번에 반환)
+  size_t dropped;
+  unsigned int seed;
+#ifdef RBTREE_STATS
+  rbtree_stats stats;
+#endif
+} setop_worker;
+
+struct setop_pool {
+  int op;
+  int n;
+  setop_worker *w;
+  int stop;
+};
+
+static node_t *setop_nodes(setop_worker *w, node_t *a, const int ha, node_t *b, const int hb, int *h);
+
+// 노드 x를 작업자의 garbage 목록에 넣는 함수
+static void setop_drop(setop_worker *w, node_t *x) {
+  w->dropped += COPIES(x);
+  SET_LEFT(x, w->garbage);
+  w->garbage = x;
+}
+
+// 서브트리 x의 노드를 모두 버리는 함수 (오른쪽으로 회전해 펴 가며 스택 없이 순회)
+static void setop_discard(setop_worker *w, node_t *x) {
+  const rbtree *t = &w->t;
+  while (x != t->nil) {
+    node_t *l = LEFT(x);
+    if (l == t->nil) {
+      node_t *r = RIGHT(x);
+      setop_drop(w, x);
+      x = r;
+    } else {
+      SET_LEFT(x, RIGHT(l));
+      SET_RIGHT(l, x);
+      x = l;
+    }
+  }
+}
+
+// 서브트리 x의 key 수를 세는 함수 (key가 모두 같은 작은 서브트리에만 쓴다)
+static size_t setop_count(const rbtree *t, node_t *x) {
+  if (x == t->nil)
+    return 0;
+#ifdef RBTREE_ORDER_STAT
+  return x->size;
+#else
+  return setop_count(t, LEFT(x)) + setop_count(t, RIGHT(x)) + COPIES(x);
+#endif
+}
+
+// key가 모두 같고 key 수가 have인 서브트리 *x에서 keep개만 남기는 함수
+static void setop_trim(setop_worker *w, node_t **x, int *h, size_t have, const size_t keep) {
+  if (keep == 0) {
+    setop_discard(w, *x);
+    *x = w->t.nil;
+    *h = 0;
+    return;
+  }
+  rbtree sub = w->t;
+  sub.root = *x;
+  while (have > keep) {
+    node_t *z = subtree_min(&sub, sub.root);
+#ifdef RBTREE_COUNTED
+    // 노드를 통째로 빼면 모자라게 되는 경우 개수만 줄인다
+    if (have - COPIES(z) < keep) {
+      w->dropped += have - keep;
+      copies_change(&sub, z, -(long)(have - keep));
+      break;
+    }
+#endif
+    have -= COPIES(z);
+    detach_node(&sub, z);
+    setop_drop(w, z);
+  }
+  *x = sub.root;
+  *h = black_height(&sub, sub.root);
+}
+
+static void setop_run(setop_worker *w, setop_task *task) {
+  task->res = setop_nodes(w, task->a, task->ha, task->b, task->hb, &task->hres);
+  __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+// 다른 작업자의 deque에서 가장 오래된 작업을 하나 훔치는 함수 (없으면 NULL)
+static setop_task *setop_steal(setop_worker *w) {
+  setop_pool *p = w->pool;
+  const int start = rand_r(&w->seed) % p->n;
+  for (int i = 0; i < p->n; i++) {
+    setop_worker *v = &p->w[(start + i) % p->n];
+    if (v == w)
+      continue;
+    setop_task *task = NULL;
+    pthread_mutex_lock(&v->lock);
+    if (v->top < v->bottom)
+      task = v->deque[v->top++];
+    pthread_mutex_unlock(&v->lock);
+    if (task != NULL)
+      return task;
+  }
+  return NULL;
+}
+
+// 서로 겹치지 않는 두 서브트리 쌍을 처리하는 함수
+// 충분히 크면 x를 deque에 내놓고 y를 직접 처리한 뒤, x를 아무도 가져가지 않았으면 직접 처리한다.
+// x를 도둑맞았으면 끝날 때까지 다른 작업을 훔쳐 처리하며 기다린다.
+static void setop_pair(setop_worker *w, setop_task *x, setop_task *y) {
+  int spawned = 0;
+  if (w->pool->n > 1 && (x->ha > SETOP_GRAIN || x->hb > SETOP_GRAIN)) {
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom < SETOP_DEQUE_CAP) {
+      w->deque[w->bottom++] = x;
+      spawned = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+  setop_run(w, y);
+  if (!spawned) {
+    setop_run(w, x);
+    return;
+  }
+
+  // x보다 나중에 넣은 작업은 모두 끝났으므로, x는 bottom에 있거나 도둑맞았다
+  pthread_mutex_lock(&w->lock);
+  const int mine = w->top < w->bottom && w->deque[w->bottom - 1] == x;
+  if (mine)
+    w->bottom--;
+  if (w->top == w->bottom)
+    w->top = w->bottom = 0;
+  pthread_mutex_unlock(&w->lock);
+  if (mine) {
+    setop_run(w, x);
+    return;
+  }
+  while (!__atomic_load_n(&x->done, __ATOMIC_ACQUIRE)) {
+    setop_task *other = setop_steal(w);
+    if (other != NULL)
+      setop_run(w, other);
+    else
+      sched_yield();
+  }
+}
+
+// black-height가 ha, hb인 서브트리 a, b에 집합 연산을 적용한 결과의 루트를 반환하는 함수 (*h: 결과의 black-height)
+static node_t *setop_nodes(setop_worker *w, node_t *a, const int ha, node_t *b, const int hb, int *h) {
+  rbtree *t = &w->t;
+  const int op = w->pool->op;
+  if (a == t->nil || b == t->nil) {
+    if (op == SETOP_UNION) {
+      *h = a == t->nil ? hb : ha;
+      return a == t->nil ? b : a;
+    }
+    setop_discard(w, b);
+    if (op == SETOP_INTERSECT) {
+      setop_discard(w, a);
+      *h = 0;
+      return t->nil;
+    }
+    *h = ha;
+    return a;
+  }
+
+  const key_t key = a->key;
+  setop_task lo = {0}, hi = {0};
+  if (op == SETOP_UNION) {
+    // a의 루트를 그대로 pivot으로 쓰고 b만 key로 나눈다
+    const int hc = ha - (COLOR(a) == RBTREE_BLACK);
+    lo.a = LEFT(a);
+    hi.a = RIGHT(a);
+    lo.ha = detach_subtree(t, lo.a, hc);
+    hi.ha = detach_subtree(t, hi.a, hc);
+    split_nodes(t, b, hb, key, 0, &lo.b, &lo.hb, &hi.b, &hi.hb);
+#ifdef RBTREE_COUNTED
+    // b의 같은 key는 a의 루트 노드에 개수로 합친다 (합친 개수는 버린 것이 아니므로 dropped에서 다시 뺀다)
+    if (!t->intrusive) {
+      node_t *eb;
+      int heb;
+      split_nodes(t, hi.b, hi.hb, key, 1, &eb, &heb, &hi.b, &hi.hb);
+      const size_t cb = setop_count(t, eb);
+      if (COPIES(a) + cb <= RBTREE_MAX_COPIES) {
+        a->copies += cb;
+        setop_discard(w, eb);
+        w->dropped -= cb;
+      } else {
+        hi.b = concat_nodes(t, eb, heb, hi.b, hi.hb, &hi.hb);
+      }
+    }
+#endif
+    setop_pair(w, &lo, &hi);
+    return join_nodes(t, lo.res, lo.hres, a, hi.res, hi.hres, h);
+  }
+
+  // 같은 key가 양쪽 서브트리에 흩어져 있을 수 있으므로 두 트리 모두 key 미만, key, key 초과로 나눈다
+  node_t *ea, *eb;
+  int hea, heb;
+  split_nodes(t, a, ha, key, 0, &lo.a, &lo.ha, &ea, &hea);
+  split_nodes(t, ea, hea, key, 1, &ea, &hea, &hi.a, &hi.ha);
+  split_nodes(t, b, hb, key, 0, &lo.b, &lo.hb, &eb, &heb);
+  split_nodes(t, eb, heb, key, 1, &eb, &heb, &hi.b, &hi.hb);
+  const size_t ca = setop_count(t, ea), cb = setop_count(t, eb);
+  const size_t keep = op == SETOP_INTERSECT ? (ca < cb ? ca : cb) : (ca > cb ? ca - cb : 0);
+  setop_discard(w, eb);
+  setop_trim(w, &ea, &hea, ca, keep);
+
+  setop_pair(w, &lo, &hi);
+  int hm;
+  node_t *m = concat_nodes(t, lo.res, lo.hres, ea, hea, &hm);
+  return concat_nodes(t, m, hm, hi.res, hi.hres, h);
+}
+
+static void *setop_thread(void *arg) {
+  setop_worker *w = (setop_worker *)arg;
+  while (!__atomic_load_n(&w->pool->stop, __ATOMIC_ACQUIRE)) {
+    setop_task *task = setop_steal(w);
+    if (task != NULL)
+      setop_run(w, task);
+    else
+      sched_yield();
+  }
+  return NULL;
+}
+
+// a와 b에 집합 연산을 적용해 a에 담고 b 구조체를 해제하는 함수 (합칠 수 없는 트리면 NULL, 아무것도 바꾸지 않음)
+static rbtree *rbtree_setop(rbtree *a, rbtree *b, const int op, int threads) {
+  if (a == b || a->cow != NULL || b->cow != NULL || a->intrusive != b->intrusive ||
+      a->node_size != b->node_size || (a->arena == NULL) != (b->arena == NULL))
+    return NULL;
+  if (threads < 1)
+    threads = 1;
+  setop_pool p = {op, threads, (setop_worker *)calloc(threads, sizeof(setop_worker)), 0};
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  if (p.w == NULL || tids == NULL || arena_join(a, b) != 0) {
+    free(p.w);
+    free(tids);
+    return NULL;
+  }
+  for (int i = 0; i < threads; i++) {
+    setop_worker *w = &p.w[i];
+    w->pool = &p;
+    w->t = *a;
+#ifdef RBTREE_STATS
+    w->t.stats = &w->stats;
+#endif
+    pthread_mutex_init(&w->lock, NULL);
+    w->garbage = a->nil;
+    w->seed = i + 1;
+  }
+  // 스레드를 만들지 못해도 나머지 작업자가 모든 작업을 처리한다
+  int started = 1;
+  while (started < threads && pthread_create(&tids[started], NULL, setop_thread, &p.w[started]) == 0)
+    started++;
+
+  const size_t total = a->count + b->count;
+  int h;
+  a->root = setop_nodes(&p.w[0], a->root, black_height(a, a->root), b->root, black_height(b, b->root), &h);
+  __atomic_store_n(&p.stop, 1, __ATOMIC_RELEASE);
+  for (int i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  size_t dropped = 0;
+  for (int i = 0; i < threads; i++) {
+    setop_worker *w = &p.w[i];
+    dropped += w->dropped;
+    for (node_t *x = w->garbage, *next; x != a->nil; x = next) {
+      next = LEFT(x);
+      if (!a->intrusive)
+        node_free(a, x);
+    }
+    pthread_mutex_destroy(&w->lock);
+#ifdef RBTREE_STATS
+    const size_t *src = (const size_t *)&w->stats;
+    size_t *dst = (size_t *)a->stats;
+    for (size_t j = 0; j < sizeof(rbtree_stats) / sizeof(size_t); j++)
+      dst[j] += src[j];
+#endif
+  }
+  a->count = total - dropped;
+  a->rightmost = NULL;
+  free(p.w);
+  free(tids);
+#ifdef RBTREE_STATS
+  free(b->stats);
+#endif
+  free(b);
+  return a;
+}
+
+// a와 b의 모든 노드를 a에 모으는 함수 (multiset 합, b 구조체는 해제됨)
+rbtree *rbtree_union(rbtree *a, rbtree *b, const int threads) {
+  return rbtree_setop(a, b, SETOP_UNION, threads);
+}
+
+// a에서 key마다 min(a의 개수, b의 개수)개만 남기는 함수 (b의 노드와 구조체는 해제됨)
+rbtree *rbtree_intersect(rbtree *a, rbtree *b, const int threads) {
+  return rbtree_setop(a, b, SETOP_INTERSECT, threads);
+}
+
+// a에서 key마다 b에 있는 개수만큼 노드를 지우는 함수 (b의 노드와 구조체는 해제됨)
+rbtree *rbtree_difference(rbtree *a, rbtree *b, const int threads) {
+  return rbtree_setop(a, b, SETOP_DIFFERENCE, threads);
+}
+#endif
+
+/* 20. 파일로 저장하고 불러오기 */
+// 파일 형식: 32바이트 헤더 뒤에 key가 오름차순으로 count개 (중복 key는 개수만큼 반복)
+// 헤더와 key는 이 기계의 바이트 순서로 저장하며, 다른 바이트 순서나 key 크기의 파일은 magic/key_size 검사에서 거절된다.
+#define SNAP_MAGIC 0x53544252u  // "RBTS"
+#define SNAP_VERSION 1
+#define SNAP_CHUNK 4096  // 저장할 때 한 번에 쓰는 key 수
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t key_size;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t checksum;  // key 영역의 체크섬 (snap_hash)
+} snap_header;
+
+// key를 하나씩 섞는 FNV-1a 방식의 체크섬 (바이트 대신 key 단위로 섞어 파일 읽기 속도를 따라간다)
+static uint64_t snap_hash(uint64_t h, const key_t *keys, const size_t n) {
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ (uint64_t)keys[i]) * 0x100000001b3ull;
+  return h;
+}
+#define SNAP_HASH_INIT 0xcbf29ce484222325ull
+
+// 버퍼의 key n개를 파일에 쓰고 헤더의 개수와 체크섬에 반영하는 함수
+static int snap_flush(FILE *f, snap_header *h, const key_t *buf, size_t *n) {
+  h->checksum = snap_hash(h->checksum, buf, *n);
+  h->count += *n;
+  const size_t written = fwrite(buf, sizeof(key_t), *n, f);
+  const int err = written != *n ? -1 : 0;
+  *n = 0;
+  return err;
+}
+
+struct rbtree_mapped {
+  void *map;
+  size_t len;
+  const key_t *keys;
+  size_t n;
+};
+
+// 트리의 key를 순서대로 path에 저장하는 함수 (성공하면 0, 실패하면 -1)
+// path.tmp에 모두 쓴 뒤 rename하므로, 실패하거나 중간에 멈춰도 기존 파일은 그대로 남는다.
+// 부모 포인터 없이 도는 반복자를 쓰므로 copy-on-write 트리와 스냅샷 view도 저장할 수 있다.
+int rbtree_save(const rbtree *t, const char *path) {
+  const size_t plen = strlen(path);
+  char *tmp = (char *)malloc(plen + 5);
+  key_t *buf = (key_t *)malloc(SNAP_CHUNK * sizeof(key_t));
+  FILE *f = NULL;
+  if (tmp == NULL || buf == NULL)
+    goto fail;
+  memcpy(tmp, path, plen);
+  memcpy(tmp + plen, ".tmp", 5);
+  f = fopen(tmp, "wb");
+  if (f == NULL)
+    goto fail;
+
+  snap_header h = {SNAP_MAGIC, SNAP_VERSION, sizeof(key_t), 0, 0, SNAP_HASH_INIT};
+  if (fwrite(&h, sizeof(h), 1, f) != 1)
+    goto fail;
+  rbtree_iter it;
+  rbtree_iter_init(&it, t);
+  size_t n = 0;
+  for (node_t *x = rbtree_iter_next(&it); x != NULL; x = rbtree_iter_next(&it)) {
+    for (size_t c = COPIES(x); c > 0; c--) {
+      buf[n++] = x->key;
+      if (n == SNAP_CHUNK && snap_flush(f, &h, buf, &n) != 0)
+        goto fail;
+    }
+  }
+  if (snap_flush(f, &h, buf, &n) != 0)
+    goto fail;
+  if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1)
+    goto fail;
+  if (fclose(f) != 0) {
+    f = NULL;
+    goto fail;
+  }
+  f = NULL;
+  if (rename(tmp, path) != 0)
+    goto fail;
+  free(tmp);
+  free(buf);
+  return 0;
+
+fail:
+  if (f != NULL)
+    fclose(f);
+  if (tmp != NULL)
+    remove(tmp);
+  free(tmp);
+  free(buf);
+  return -1;
+}
+
+// path를 읽기 전용으로 mmap하고 헤더, 크기, 체크섬, 정렬 순서를 검사하는 함수 (실패하면 -1)
+static int snap_map(const char *path, rbtree_mapped *m) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snap_header)) {
+    close(fd);
+    return -1;
+  }
+  m->len = (size_t)st.st_size;
+  m->map = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // 매핑은 fd를 닫아도 유지된다
+  if (m->map == MAP_FAILED)
+    return -1;
+  madvise(m->map, m->len, MADV_SEQUENTIAL);
+
+  const snap_header *h = (const snap_header *)m->map;
+  m->keys = (const key_t *)((const char *)m->map + sizeof(snap_header));
+  m->n = (size_t)h->count;
+  int ok = h->magic == SNAP_MAGIC && h->version == SNAP_VERSION && h->key_size == sizeof(key_t) &&
+           h->count <= (m->len - sizeof(snap_header)) / sizeof(key_t) &&
+           m->len == sizeof(snap_header) + m->n * sizeof(key_t);
+  if (ok && snap_hash(SNAP_HASH_INIT, m->keys, m->n) != h->checksum)
+    ok = 0;
+  for (size_t i = 1; ok && i < m->n; i++)
+    if (m->keys[i - 1] > m->keys[i])
+      ok = 0;
+  if (!ok) {
+    munmap(m->map, m->len);
+    return -1;
+  }
+  return 0;
+}
+
+// rbtree_save로 저장한 파일을 mmap해 O(n)에 트리를 만드는 함수 (파일이 없거나 손상됐으면 NULL)
+// key를 하나씩 삽입하지 않고 매핑한 정렬 배열에서 rbtree_from_sorted로 바로 만든다.
+rbtree *rbtree_load(const char *path) {
+  rbtree_mapped m;
+  if (snap_map(path, &m) != 0)
+    return NULL;
+  rbtree *t = rbtree_from_sorted(m.keys, m.n);
+  munmap(m.map, m.len);
+  return t;
+}
+
+// rbtree_save로 저장한 파일을 노드를 만들지 않고 읽기 전용으로 여는 함수 (실패하면 NULL)
+// 탐색은 매핑한 정렬 배열에서 이분 탐색으로 하며, 여는 시점에 체크섬을 확인하느라 파일을 한 번 읽는다.
+rbtree_mapped *rbtree_mapped_open(const char *path) {
+  rbtree_mapped *m = (rbtree_mapped *)malloc(sizeof(rbtree_mapped));
+  if (m == NULL)
+    return NULL;
+  if (snap_map(path, m) != 0) {
+    free(m);
+    return NULL;
+  }
+  madvise(m->map, m->len, MADV_RANDOM);
+  return m;
+}
+
+void rbtree_mapped_close(rbtree_mapped *m) {
+  munmap(m->map, m->len);
+  free(m);
+}
+
+size_t rbtree_mapped_size(const rbtree_mapped *m) {
+  return m->n;
+}
+
+// key가 있으면 1, 없으면 0을 반환하는 함수 (O(log n))
+int rbtree_mapped_find(const rbtree_mapped *m, const key_t key) {
+  const key_t *base = m->keys;
+  size_t len = m->n;
+  // 분기 없는 lower bound: 남은 구간의 절반씩 건너뛴다
+  while (len > 1) {
+    const size_t half = len / 2;
+    base = base[half - 1] < key ? base + half : base;
+    len -= half;
+  }
+  return len == 1 && *base == key;
+}
+
+// 최소 key를 *out에 저장하는 함수 (빈 파일이면 0을 반환)
+int rbtree_mapped_min(const rbtree_mapped *m, key_t *out) {
+  if (m->n == 0)
+    return 0;
+  *out = m->keys[0];
+  return 1;
+}
+
+// 최대 key를 *out에 저장하는 함수 (빈 파일이면 0을 반환)
+int rbtree_mapped_max(const rbtree_mapped *m, key_t *out) {
+  if (m->n == 0)
+    return 0;
+  *out = m->keys[m->n - 1];
+  return 1;
+}
+
+/* 21. 읽기 전용으로 얼린 트리 (frozen) */
+// 정렬된 key를 FROZEN_B개씩 묶은 블록의 (B+1)진 Eytzinger 배열(BFS 순서)로 다시 배치한다.
+// 블록 k의 i번째 자식은 블록 k * (B + 1) + i + 1이고, 한 블록은 AVX2 레지스터 하나(32바이트)에 들어간다.
+// 트리 높이가 log_(B+1) n으로 줄어 탐색 한 번에 캐시 미스가 20~30번에서 5~7번 정도로 줄어든다.
+// 마지막 블록의 빈 자리는 FROZEN_PAD로 채우며, 중위 순서에서 모든 key 뒤에 온다.
+#define FROZEN_B 8
+#define FROZEN_PAD INT_MAX  // key_t의 최댓값 (key_t를 바꾸면 함께 바꾼다)
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define FROZEN_AVX2 1
+#endif
+
+struct rbtree_frozen {
+  key_t *keys;     // nblocks * FROZEN_B개, 64바이트 정렬
+  size_t nblocks;
+  size_t n;        // 실제 key 수 (중복 포함)
+  key_t min, max;
+  int avx2;        // 얼린 시점에 CPU가 AVX2를 지원했는지
+};
+
+// 블록 k를 루트로 하는 부분 트리를 중위 순서로 채우는 함수 (*i: 다음에 넣을 sorted의 위치)
+static void frozen_build(rbtree_frozen *f, const key_t *sorted, size_t *i, const size_t k) {
+  if (k >= f->nblocks)
+    return;
+  for (size_t j = 0; j < FROZEN_B; j++) {
+    frozen_build(f, sorted, i, k * (FROZEN_B + 1) + j + 1);
+    f->keys[k * FROZEN_B + j] = *i < f->n ? sorted[(*i)++] : FROZEN_PAD;
+  }
+  frozen_build(f, sorted, i, k * (FROZEN_B + 1) + FROZEN_B + 1);
+}
+
+// frozen_build의 역: 중위 순서로 key를 sorted에 꺼내는 함수
+static void frozen_unbuild(const rbtree_frozen *f, key_t *sorted, size_t *i, const size_t k) {
+  if (k >= f->nblocks)
+    return;
+  for (size_t j = 0; j < FROZEN_B; j++) {
+    frozen_unbuild(f, sorted, i, k * (FROZEN_B + 1) + j + 1);
+    if (*i < f->n)
+      sorted[(*i)++] = f->keys[k * FROZEN_B + j];
+  }
+  frozen_unbuild(f, sorted, i, k * (FROZEN_B + 1) + FROZEN_B + 1);
+}
+
+// lower bound 탐색: key 이상인 가장 작은 원소를 *out에 저장하고, 있으면 1을 반환하는 함수
+// 블록마다 key보다 작은 원소 수(r)를 분기 없이 세어 r번째 자식으로 내려가며,
+// r < B이면 그 블록의 r번째 원소가 지금까지의 후보보다 작으므로 후보를 바꾼다.
+static int frozen_search_scalar(const rbtree_frozen *f, const key_t key, key_t *out) {
+  key_t cand = FROZEN_PAD;
+  for (size_t k = 0; k < f->nblocks;) {
+    const key_t *blk = f->keys + k * FROZEN_B;
+    size_t r = 0;
+    for (size_t j = 0; j < FROZEN_B; j++)
+      r += blk[j] < key;
+    cand = r < FROZEN_B ? blk[r] : cand;
+    k = k * (FROZEN_B + 1) + r + 1;
+  }
+  *out = cand;
+  // FROZEN_PAD와 같은 key가 실제로 있을 때만 FROZEN_PAD를 답으로 인정한다
+  return f->n > 0 && (cand != FROZEN_PAD || f->max == FROZEN_PAD);
+}
+
+#ifdef FROZEN_AVX2
+// frozen_search_scalar와 같은 탐색을 블록당 비교 한 번(8개 동시)으로 하는 AVX2 버전
+__attribute__((target("avx2,popcnt")))
+static int frozen_search_avx2(const rbtree_frozen *f, const key_t key, key_t *out) {
+  const __m256i k8 = _mm256_set1_epi32(key);
+  key_t cand = FROZEN_PAD;
+  for (size_t k = 0; k < f->nblocks;) {
+    const key_t *blk = f->keys + k * FROZEN_B;
+    const __m256i v = _mm256_load_si256((const __m256i *)blk);
+    const int lt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k8, v)));
+    const size_t r = (size_t)__builtin_popcount((unsigned)lt);
+    cand = r < FROZEN_B ? blk[r] : cand;
+    k = k * (FROZEN_B + 1) + r + 1;
+  }
+  *out = cand;
+  return f->n > 0 && (cand != FROZEN_PAD || f->max == FROZEN_PAD);
+}
+#endif
+
+static int frozen_search(const rbtree_frozen *f, const key_t key, key_t *out) {
+#ifdef FROZEN_AVX2
+  if (f->avx2)
+    return frozen_search_avx2(f, key, out);
+#endif
+  return frozen_search_scalar(f, key, out);
+}
+
+// 트리를 읽기 전용 배열로 바꾸고 트리를 해제하는 함수 (O(n))
+// 맵 트리와 intrusive 트리는 key만으로 되돌릴 수 없으므로 NULL을 반환하고 트리를 그대로 둔다.
+// 메모리가 부족해도 NULL을 반환하며 트리는 그대로 남는다.
+// 환경 변수 RBTREE_NO_AVX2가 있으면 AVX2를 지원하는 CPU에서도 스칼라 탐색을 쓴다 (비교용).
+rbtree_frozen *rbtree_freeze(rbtree *t) {
+  if (t->value_size != 0 || t->intrusive)
+    return NULL;
+  const size_t n = t->count;
+  rbtree_frozen *f = (rbtree_frozen *)malloc(sizeof(rbtree_frozen));
+  key_t *sorted = (key_t *)malloc((n > 0 ? n : 1) * sizeof(key_t));
+  if (f == NULL || sorted == NULL) {
+    free(f);
+    free(sorted);
+    return NULL;
+  }
+  f->n = n;
+  f->nblocks = (n + FROZEN_B - 1) / FROZEN_B;
+  // aligned_alloc의 크기는 정렬의 배수여야 한다 (빈 트리도 0이 아닌 크기로 할당)
+  f->keys = (key_t *)aligned_alloc(64, f->nblocks * FROZEN_B * sizeof(key_t) / 64 * 64 + 64);
+  if (f->keys == NULL) {
+    free(f);
+    free(sorted);
+    return NULL;
+  }
+  rbtree_to_array(t, sorted, n);
+  size_t i = 0;
+  frozen_build(f, sorted, &i, 0);
+  f->min = n > 0 ? sorted[0] : FROZEN_PAD;
+  f->max = n > 0 ? sorted[n - 1] : FROZEN_PAD;
+  f->avx2 = 0;
+#ifdef FROZEN_AVX2
+  f->avx2 = sizeof(key_t) == 4 && __builtin_cpu_supports("avx2") && getenv("RBTREE_NO_AVX2") == NULL;
+#endif
+  free(sorted);
+  delete_rbtree(t);
+  return f;
+}
+
+// 얼린 배열을 다시 수정 가능한 트리로 만들고 배열을 해제하는 함수 (O(n), 실패하면 NULL이고 f는 그대로)
+rbtree *rbtree_thaw(rbtree_frozen *f) {
+  key_t *sorted = (key_t *)malloc((f->n > 0 ? f->n : 1) * sizeof(key_t));
+  if (sorted == NULL)
+    return NULL;
+  size_t i = 0;
+  frozen_unbuild(f, sorted, &i, 0);
+  rbtree *t = rbtree_from_sorted(sorted, f->n);
+  free(sorted);
+  if (t != NULL)
+    delete_rbtree_frozen(f);
+  return t;
+}
+
+void delete_rbtree_frozen(rbtree_frozen *f) {
+  free(f->keys);
+  free(f);
+}
+
+size_t rbtree_frozen_size(const rbtree_frozen *f) {
+  return f->n;
+}
+
+// key가 있으면 1, 없으면 0을 반환하는 함수
+int rbtree_frozen_find(const rbtree_frozen *f, const key_t key) {
+  key_t found;
+  return frozen_search(f, key, &found) && found == key;
+}
+
+// key 이상인 가장 작은 key를 *out에 저장하는 함수 (없으면 0을 반환)
+int rbtree_frozen_lower_bound(const rbtree_frozen *f, const key_t key, key_t *out) {
+  return frozen_search(f, key, out);
+}
+
+// 최소 key를 *out에 저장하는 함수 (비었으면 0을 반환)
+int rbtree_frozen_min(const rbtree_frozen *f, key_t *out) {
+  if (f->n == 0)
+    return 0;
+  *out = f->min;
+  return 1;
+}
+
+// 최대 key를 *out에 저장하는 함수 (비었으면 0을 반환)
+int rbtree_frozen_max(const rbtree_frozen *f, key_t *out) {
+  if (f->n == 0)
+    return 0;
+  *out = f->max;
+  return 1;
+}
+
+/* 22. 부모 포인터 없는 top-down 엔진 (RBTREE_TOPDOWN) */
+// 삽입과 삭제 모두 루트에서 한 번만 내려가며, 다음 노드에서 고칠 일이 생기지 않도록
+// 내려가는 길에 색 뒤집기와 회전을 미리 해 둔다. 올라오며 고치는 fixup이 없으므로 부모 포인터가 필요 없다.
+// 루트 위에는 스택에 둔 head 노드를 달아, 회전으로 루트가 바뀌는 경우도 다른 노드와 똑같이 다룬다.
+// 같은 key의 노드는 주소 순으로 놓아 (key, 주소)가 전순서가 되게 하므로, 부모 포인터 없이도
+// 특정 노드까지의 경로를 같은 key가 몇 개든 한 갈래로 O(log n)에 찾을 수 있다.
+#ifdef RBTREE_TOPDOWN
+#define TD_RED(x) (COLOR(x) == RBTREE_RED)
+#define TD_LINK(x, d) ((d) ? RIGHT(x) : LEFT(x))
+
+// x의 d쪽 자식(0이면 왼쪽, 1이면 오른쪽)을 y로 바꾸는 함수
+static void td_set_link(node_t *x, const int d, node_t *y) {
+  if (d)
+    SET_RIGHT(x, y);
+  else
+    SET_LEFT(x, y);
+}
+
+// x를 d 방향으로 회전해 올라온 자식을 검정, x를 빨강으로 칠하고 올라온 노드를 반환하는 함수
+static node_t *td_single(rbtree *t, node_t *x, const int d) {
+  STAT_INC(t, rotations);
+  node_t *y = TD_LINK(x, !d);
+  td_set_link(x, !d, TD_LINK(y, d));
+  td_set_link(y, d, x);
+  RECOLOR(t, x, RBTREE_RED);
+  RECOLOR(t, y, RBTREE_BLACK);
+  return y;
+}
+
+// x의 !d쪽 자식을 반대로 한 번 돌린 뒤 x를 d 방향으로 회전하는 함수
+static node_t *td_double(rbtree *t, node_t *x, const int d) {
+  td_set_link(x, !d, td_single(t, TD_LINK(x, !d), !d));
+  return td_single(t, x, d);
+}
+
+// key를 추가하는 함수 (unique면 같은 key의 노드가 있을 때 그 노드를 반환)
+// 두 자식이 모두 빨간 노드는 색을 뒤집어 미리 나누고, 그때 생긴 빨강-빨강은 바로 위 조부모에서 회전해 고친다.
+// 새 노드를 붙인 뒤에는 위로 전파될 위반이 없으므로 내려간 한 번으로 끝난다.
+static node_t *td_insert(rbtree *t, const key_t key, const int unique, int *inserted) {
+  *inserted = 0;
+  STAT_DESCENT_BEGIN(t);
+  if (t->root == t->nil) {
+    STAT_DESCENT_END(t);
+    node_t *z = new_node(t, key);
+    if (z == NULL)
+      return NULL;
+    SET_COLOR(z, RBTREE_BLACK);
+#ifdef RBTREE_COUNTED
+    z->copies = 1;
+#endif
+    t->root = z;
+    t->count++;
+    *inserted = 1;
+    return z;
+  }
+
+  node_t head;
+  SET_COLOR(&head, RBTREE_BLACK);
+  SET_LEFT(&head, t->nil);
+  SET_RIGHT(&head, t->root);
+  // gg, g, p, q: 증조부모, 조부모, 부모, 현재 노드
+  node_t *gg = &head, *g = t->nil, *p = t->nil, *q = t->root, *z = NULL;
+  int dir = 0, last = 0;
+  for (;;) {
+    if (q == t->nil) {
+      if (z == NULL)
+        z = new_node(t, key);
+      if (z == NULL)
+        break;
+      q = z;
+#ifdef RBTREE_COUNTED
+      z->copies = 1;
+#endif
+      td_set_link(p, dir, z);
+      t->count++;
+      *inserted = 1;
+    } else if (TD_RED(LEFT(q)) && TD_RED(RIGHT(q))) {
+      STAT_INC(t, insert_fixups);
+      RECOLOR(t, q, RBTREE_RED);
+      RECOLOR(t, LEFT(q), RBTREE_BLACK);
+      RECOLOR(t, RIGHT(q), RBTREE_BLACK);
+    }
+    if (TD_RED(q) && TD_RED(p)) {
+      const int dir2 = RIGHT(gg) == g;
+      td_set_link(gg, dir2, q == TD_LINK(p, last) ? td_single(t, g, !last) : td_double(t, g, !last));
+    }
+    if (q == z)
+      break;
+
+    STAT_INC(t, comparisons);
+    if (q->key == key) {
+      if (unique) {
+        z = q;
+        break;
+      }
+#ifdef RBTREE_COUNTED
+      // 같은 key의 노드가 있으면 새 노드 대신 그 노드의 개수를 늘린다 (가득 찬 노드는 건너뜀)
+      if (q->copies < RBTREE_MAX_COPIES) {
+        copies_change(t, q, 1);
+        z = q;
+        break;
+      }
+#endif
+      // 같은 key의 노드 사이에서는 주소로 자리를 정하므로 새 노드를 여기서 미리 만든다
+      if (z == NULL && (z = new_node(t, key)) == NULL)
+        break;
+    }
+    last = dir;
+    dir = q->key == key ? (uintptr_t)q < (uintptr_t)z : !(key < q->key);
+    if (g != t->nil)
+      gg = g;
+    g = p;
+    p = q;
+    q = TD_LINK(q, dir);
+  }
+  STAT_DESCENT_END(t);
+  t->root = RIGHT(&head);
+  SET_COLOR(t->root, RBTREE_BLACK);
+  return z;
+}
+
+// target(NULL이면 key를 가진 아무 노드)을 삭제하고, 삭제했으면 1을 반환하는 함수
+// 내려가는 노드가 늘 빨강이 되도록 형제에게서 빨강을 빌려 오거나(회전) 부모와 색을 맞바꾼다(색 뒤집기).
+// 지울 노드 f를 지나면 f의 직전 노드까지 내려가고, 그 노드를 떼어 f의 자리에 옮겨 단다.
+// 노드의 key만 복사하지 않고 노드를 통째로 옮기므로, 다른 노드 포인터와 맵 값은 그대로 유효하다.
+static int td_remove(rbtree *t, const key_t key, node_t *target) {
+  if (t->root == t->nil)
+    return 0;
+
+  node_t head;
+  SET_COLOR(&head, RBTREE_BLACK);
+  SET_LEFT(&head, t->nil);
+  SET_RIGHT(&head, t->root);
+  node_t *g = t->nil, *p = t->nil, *q = &head;
+  node_t *f = NULL, *fp = NULL;  // 지울 노드와 그 부모 (회전으로 f가 내려가면 fp도 바뀐다)
+  int dir = 1, found = 0;
+  STAT_DESCENT_BEGIN(t);
+  while (TD_LINK(q, dir) != t->nil) {
+    const int last = dir;
+    g = p;
+    p = q;
+    q = TD_LINK(q, dir);
+
+    if (f != NULL) {
+      dir = 1;  // f의 왼쪽 서브트리에서 최대 노드(직전 노드)로
+    } else if (target != NULL ? q == target : q->key == key) {
+      STAT_INC(t, comparisons);
+#ifdef RBTREE_COUNTED
+      // 같은 key가 여러 개 있는 노드는 개수만 줄인다 (지금까지의 변형도 균형을 깨지 않는다)
+      if (target == NULL && q->copies > 1) {
+        copies_change(t, q, -1);
+        found = 1;
+        break;
+      }
+#endif
+      f = q;
+      fp = p;
+      dir = 0;
+    } else {
+      STAT_INC(t, comparisons);
+      // 같은 key의 노드는 주소 순으로 놓여 있으므로 target의 주소와 비교해 방향을 정한다
+      dir = q->key < key || (q->key == key && (uintptr_t)q < (uintptr_t)target);
+    }
+
+    if (!TD_RED(q) && !TD_RED(TD_LINK(q, dir))) {
+      STAT_INC(t, erase_fixups);
+      if (TD_RED(TD_LINK(q, !dir))) {
+        // 반대쪽 빨간 자식을 올려 q를 빨강으로 만든다
+        node_t *r = td_single(t, q, dir);
+        td_set_link(p, last, r);
+        p = r;
+        if (q == f)
+          fp = p;
+      } else {
+        node_t *s = TD_LINK(p, !last);
+        if (s != t->nil) {
+          if (!TD_RED(LEFT(s)) && !TD_RED(RIGHT(s))) {
+            RECOLOR(t, p, RBTREE_BLACK);
+            RECOLOR(t, s, RBTREE_RED);
+            RECOLOR(t, q, RBTREE_RED);
+          } else {
+            // 형제의 빨간 자식을 p 자리로 올리고 p와 형제를 그 아래 검은 노드로 둔다
+            const int dir2 = RIGHT(g) == p;
+            node_t *r = TD_RED(TD_LINK(s, last)) ? td_double(t, p, last) : td_single(t, p, last);
+            td_set_link(g, dir2, r);
+            RECOLOR(t, q, RBTREE_RED);
+            RECOLOR(t, r, RBTREE_RED);
+            RECOLOR(t, LEFT(r), RBTREE_BLACK);
+            RECOLOR(t, RIGHT(r), RBTREE_BLACK);
+            if (p == f)
+              fp = r;
+          }
+        }
+      }
+    }
+  }
+  STAT_DESCENT_END(t);
+
+  if (f != NULL) {
+    // q는 자식이 하나 이하인 빨간 노드(또는 루트)이므로 떼어내도 black-height가 바뀌지 않는다
+    td_set_link(p, RIGHT(p) == q, TD_LINK(q, LEFT(q) == t->nil));
+    if (q != f) {
+      SET_LEFT(q, LEFT(f));
+      SET_RIGHT(q, RIGHT(f));
+      SET_COLOR(q, COLOR(f));
+      td_set_link(fp, RIGHT(fp) == f, q);
+    }
+    t->count -= COPIES(f);
+    node_free(t, f);
+    found = 1;
+  }
+  t->root = RIGHT(&head);
+  if (t->root != t->nil)
+    SET_COLOR(t->root, RBTREE_BLACK);
+  return found;
+}
+
+// 서브트리 x에서 노드 z까지의 경로를 path[d]부터 기록하고 z의 깊이를 반환하는 함수 (없으면 -1)
+// 같은 key의 노드는 주소 순으로 놓여 있으므로 key가 같으면 주소를 비교해 한쪽으로만 내려간다.
+static int td_path(const rbtree *t, node_t *x, const node_t *z, node_t **path, int d) {
+  while (x != t->nil && d < RBTREE_ITER_DEPTH) {
+    path[d] = x;
+    if (x == z)
+      return d;
+    if (x->key == z->key)
+      x = (uintptr_t)z < (uintptr_t)x ? LEFT(x) : RIGHT(x);
+    else
+      x = z->key < x->key ? LEFT(x) : RIGHT(x);
+    d++;
+  }
+  return -1;
+}
+#endif
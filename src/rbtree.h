@@ -7,26 +7,342 @@ typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;
 
 typedef int key_t;
 
+/*
+ * Node layout
+ *   default          : color + key + parent/left/right pointers
+ *   RBTREE_COMPACT   : color packed into the low bit of the parent pointer
+ *   RBTREE_INDEX32   : 32-bit links into a shared node pool, color packed into
+ *                      the low bit of the parent index (16 bytes per int key)
+ *   RBTREE_COUNTED   : one node per distinct key with a 32-bit copy count
+ *   RBTREE_TOPDOWN   : no parent pointer; insert and erase rebalance in a single
+ *                      top-down pass (24 bytes per int key). Equal keys are kept
+ *                      in node address order, so rbtree_next/prev and erasing a
+ *                      given node stay O(log n) with duplicates
+ * Always go through the accessors below instead of touching the link fields.
+ */
+#if defined(RBTREE_TOPDOWN) && \
+    (defined(RBTREE_INDEX32) || defined(RBTREE_COMPACT) || defined(RBTREE_ORDER_STAT))
+#error "RBTREE_TOPDOWN cannot be combined with RBTREE_INDEX32, RBTREE_COMPACT or RBTREE_ORDER_STAT"
+#endif
+
+#if defined(RBTREE_INDEX32)
+#include <stdint.h>
+
+typedef struct node_t {
+  key_t key;
+  uint32_t parent_color;  // parent index << 1 | color
+  uint32_t left, right;   // node indices (0 is the sentinel)
+#ifdef RBTREE_COUNTED
+  uint32_t copies;  // number of copies of key held by this node
+#endif
+#ifdef RBTREE_ORDER_STAT
+  uint32_t size;  // number of nodes in the subtree rooted here
+#endif
+} node_t;
+
+// nodes live in one reserved region and are addressed in 16-byte units
+extern char *rbtree_pool_base;
+#define RBTREE_NODE_ALIGN 16
+#define RBTREE_PTR(i) ((node_t *)(rbtree_pool_base + ((size_t)(i) << 4)))
+#define RBTREE_IDX(p) ((uint32_t)(((char *)(p) - rbtree_pool_base) >> 4))
+
+#define rbtree_left(n) RBTREE_PTR((n)->left)
+#define rbtree_right(n) RBTREE_PTR((n)->right)
+#define rbtree_parent(n) RBTREE_PTR((n)->parent_color >> 1)
+#define rbtree_color(n) ((color_t)((n)->parent_color & 1))
+#define rbtree_set_left(n, c) ((n)->left = RBTREE_IDX(c))
+#define rbtree_set_right(n, c) ((n)->right = RBTREE_IDX(c))
+#define rbtree_set_parent(n, p) \
+  ((n)->parent_color = RBTREE_IDX(p) << 1 | ((n)->parent_color & 1))
+#define rbtree_set_color(n, c) \
+  ((n)->parent_color = ((n)->parent_color & ~(uint32_t)1) | (uint32_t)(c))
+
+#elif defined(RBTREE_COMPACT)
+#include <stdint.h>
+
+typedef struct node_t {
+  uintptr_t parent_color;  // parent pointer | color
+  struct node_t *left, *right;
+  key_t key;
+#ifdef RBTREE_COUNTED
+  uint32_t copies;  // number of copies of key held by this node (fills the padding)
+#endif
+#ifdef RBTREE_ORDER_STAT
+  size_t size;  // number of nodes in the subtree rooted here
+#endif
+} node_t;
+
+#define RBTREE_NODE_ALIGN _Alignof(node_t)
+
+#define rbtree_left(n) ((n)->left)
+#define rbtree_right(n) ((n)->right)
+#define rbtree_parent(n) ((node_t *)((n)->parent_color & ~(uintptr_t)1))
+#define rbtree_color(n) ((color_t)((n)->parent_color & 1))
+#define rbtree_set_left(n, c) ((n)->left = (c))
+#define rbtree_set_right(n, c) ((n)->right = (c))
+#define rbtree_set_parent(n, p) \
+  ((n)->parent_color = (uintptr_t)(p) | ((n)->parent_color & 1))
+#define rbtree_set_color(n, c) \
+  ((n)->parent_color = ((n)->parent_color & ~(uintptr_t)1) | (uintptr_t)(c))
+
+#elif defined(RBTREE_TOPDOWN)
+#ifdef RBTREE_COUNTED
+#include <stdint.h>
+#endif
+
+typedef struct node_t {
+  color_t color;
+  key_t key;
+  struct node_t *left, *right;
+#ifdef RBTREE_COUNTED
+  uint32_t copies;  // number of copies of key held by this node
+#endif
+} node_t;
+
+#define RBTREE_NODE_ALIGN _Alignof(node_t)
+
+// there is no rbtree_parent(); parent writes from shared code are dropped
+#define rbtree_left(n) ((n)->left)
+#define rbtree_right(n) ((n)->right)
+#define rbtree_color(n) ((n)->color)
+#define rbtree_set_left(n, c) ((n)->left = (c))
+#define rbtree_set_right(n, c) ((n)->right = (c))
+#define rbtree_set_parent(n, p) ((void)(n), (void)(p))
+#define rbtree_set_color(n, c) ((n)->color = (c))
+
+#else
+#ifdef RBTREE_COUNTED
+#include <stdint.h>
+#endif
+
 typedef struct node_t {
   color_t color;
   key_t key;
+#ifdef RBTREE_COUNTED
+  uint32_t copies;  // number of copies of key held by this node
+#endif
   struct node_t *parent, *left, *right;
+#ifdef RBTREE_ORDER_STAT
+  size_t size;  // number of nodes in the subtree rooted here
+#endif
 } node_t;
 
+#define RBTREE_NODE_ALIGN _Alignof(node_t)
+
+#define rbtree_left(n) ((n)->left)
+#define rbtree_right(n) ((n)->right)
+#define rbtree_parent(n) ((n)->parent)
+#define rbtree_color(n) ((n)->color)
+#define rbtree_set_left(n, c) ((n)->left = (c))
+#define rbtree_set_right(n, c) ((n)->right = (c))
+#define rbtree_set_parent(n, p) ((n)->parent = (p))
+#define rbtree_set_color(n, c) ((n)->color = (c))
+
+#endif
+
+// copies of the key held by a node (always 1 unless built with RBTREE_COUNTED);
+// with RBTREE_ORDER_STAT, size counts copies rather than nodes
+#ifdef RBTREE_COUNTED
+#define RBTREE_MAX_COPIES UINT32_MAX
+#define rbtree_copies(n) ((size_t)(n)->copies)
+#else
+#define rbtree_copies(n) ((size_t)1)
+#endif
+
+typedef struct rbtree_arena rbtree_arena;
+typedef struct rbtree_cow rbtree_cow;
+typedef struct rbtree_sync rbtree_sync;
+typedef struct rbtree_sharded rbtree_sharded;
+typedef struct rbtree_mapped rbtree_mapped;
+typedef struct rbtree_frozen rbtree_frozen;
+
+#ifdef RBTREE_STATS
+// per-tree counters, only present in RBTREE_STATS builds
+#define RBTREE_STATS_DEPTHS 64
+
+typedef struct {
+  size_t comparisons;    // key comparisons during descents
+  size_t rotations;      // left/right rotations
+  size_t recolors;       // colour writes in the fixups
+  size_t insert_fixups;  // rbtree_insert_fixup loop iterations
+  size_t erase_fixups;   // rbtree_erase_fixup loop iterations
+  size_t allocs;         // node allocations
+  size_t frees;          // node frees
+  size_t depth_hist[RBTREE_STATS_DEPTHS];  // nodes visited per descent (last bucket: or more)
+} rbtree_stats;
+#endif
+
 typedef struct {
   node_t *root;
   node_t *nil;  // for sentinel
+  rbtree_arena *arena;  // node slab allocator (NULL: malloc/free per node)
+  size_t count;         // number of nodes in the tree
+  node_t *rightmost;    // cached max node for rbtree_insert_hint (NULL: not known)
+  size_t node_size;     // bytes per node including the map value
+  size_t value_size;    // bytes of value stored after each node (map mode)
+  int intrusive;        // nodes belong to the caller (rbtree_link)
+  rbtree_cow *cow;      // copy-on-write state (NULL: update in place)
+#ifdef RBTREE_STATS
+  rbtree_stats *stats;  // counters (a pointer so read-only lookups can update them)
+#endif
 } rbtree;
 
+// intrusive mode: embed an rb_link in your own struct, set link.key and link it
+typedef node_t rb_link;
+
+#define rbtree_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+typedef enum { RBTREE_OP_INSERT, RBTREE_OP_ERASE, RBTREE_OP_FIND } rbtree_op_t;
+
+typedef struct {
+  rbtree_op_t op;
+  key_t key;
+  node_t *node;  // result: inserted or found node (NULL for erase/miss)
+  int found;     // result: whether the key was already in the tree
+} rbtree_batch_op;
+
 rbtree *new_rbtree(void);
+rbtree *new_rbtree_sized(const size_t);
 void delete_rbtree(rbtree *);
+size_t rbtree_memory_usage(const rbtree *);
 
 node_t *rbtree_insert(rbtree *, const key_t);
+node_t *rbtree_insert_unique(rbtree *, const key_t, int *);
+node_t *rbtree_insert_hint(rbtree *, node_t *, const key_t);
 node_t *rbtree_find(const rbtree *, const key_t);
 node_t *rbtree_min(const rbtree *);
 node_t *rbtree_max(const rbtree *);
+node_t *rbtree_lower_bound(const rbtree *, const key_t);
+node_t *rbtree_upper_bound(const rbtree *, const key_t);
+node_t *rbtree_next(const rbtree *, const node_t *);
+node_t *rbtree_prev(const rbtree *, const node_t *);
+size_t rbtree_find_batch(const rbtree *, const key_t *, const size_t, node_t **);
 int rbtree_erase(rbtree *, node_t *);
+int rbtree_erase_key(rbtree *, const key_t);
+size_t rbtree_erase_range(rbtree *, const key_t, const key_t);
+size_t rbtree_size(const rbtree *);
+node_t *rbtree_select(const rbtree *, const size_t);
+size_t rbtree_rank(const rbtree *, const key_t);
+
+int rbtree_apply_batch(rbtree *, rbtree_batch_op *, const size_t);
+
+rbtree *new_rbtree_map(const size_t, const size_t);
+void *rbtree_map_value(const node_t *);
+node_t *rbtree_map_insert(rbtree *, const key_t, const void *);
+void *rbtree_map_get(const rbtree *, const key_t);
+node_t *rbtree_map_upsert(rbtree *, const key_t, const void *);
+
+#if !defined(RBTREE_INDEX32) && !defined(RBTREE_TOPDOWN)
+rbtree *new_rbtree_intrusive(void);
+node_t *rbtree_link(rbtree *, rb_link *);
+void rbtree_unlink(rbtree *, rb_link *);
+#endif
+
+#ifdef RBTREE_STATS
+void rbtree_stats_get(const rbtree *, rbtree_stats *);
+void rbtree_stats_reset(rbtree *);
+#endif
+
+// thread-safe wrapper: writers serialise, readers run optimistically and retry
+rbtree_sync *new_rbtree_sync(const size_t);
+void delete_rbtree_sync(rbtree_sync *);
+rbtree *rbtree_sync_write_lock(rbtree_sync *);
+void rbtree_sync_write_unlock(rbtree_sync *);
+int rbtree_sync_insert(rbtree_sync *, const key_t);
+int rbtree_sync_erase(rbtree_sync *, const key_t);
+int rbtree_sync_find(rbtree_sync *, const key_t);
+int rbtree_sync_min(rbtree_sync *, key_t *);
+int rbtree_sync_max(rbtree_sync *, key_t *);
+size_t rbtree_sync_range(rbtree_sync *, const key_t, const key_t, key_t *, const size_t);
+
+// key-range sharded container: one tree and one lock per shard
+rbtree_sharded *new_rbtree_sharded(const size_t);
+void delete_rbtree_sharded(rbtree_sharded *);
+int rbtree_sharded_insert(rbtree_sharded *, const key_t);
+int rbtree_sharded_erase(rbtree_sharded *, const key_t);
+int rbtree_sharded_find(rbtree_sharded *, const key_t);
+int rbtree_sharded_min(rbtree_sharded *, key_t *);
+int rbtree_sharded_max(rbtree_sharded *, key_t *);
+size_t rbtree_sharded_size(rbtree_sharded *);
+size_t rbtree_sharded_to_array(rbtree_sharded *, key_t *, const size_t);
+
+// copy-on-write mode: lock-free readers pin a version with an epoch slot
+#define RBTREE_COW_READERS 64
+
+rbtree *new_rbtree_cow(void);
+int rbtree_cow_reader_add(rbtree *);
+void rbtree_cow_reader_remove(rbtree *, const int);
+void rbtree_cow_read_lock(const rbtree *, const int);
+void rbtree_cow_read_unlock(const rbtree *, const int);
+size_t rbtree_cow_retired(const rbtree *);
+
+// O(1) snapshot of a copy-on-write tree: a pinned, read-only version
+typedef struct {
+  rbtree view;   // root and count of the pinned version
+  rbtree *tree;  // live tree the snapshot was taken from
+  int slot;      // reader slot holding the version
+} rbtree_snapshot_t;
+
+// in-order iterator that does not need parent pointers
+#define RBTREE_ITER_DEPTH 128
+
+typedef struct {
+  const rbtree *tree;
+  node_t *stack[RBTREE_ITER_DEPTH];
+  int top;
+} rbtree_iter;
+
+rbtree_snapshot_t *rbtree_snapshot(rbtree *);
+const rbtree *rbtree_snapshot_view(const rbtree_snapshot_t *);
+void rbtree_snapshot_release(rbtree_snapshot_t *);
+void rbtree_iter_init(rbtree_iter *, const rbtree *);
+node_t *rbtree_iter_next(rbtree_iter *);
+
+// resumable position for rbtree_to_array_next
+typedef struct {
+  node_t *node;    // next node to export, NULL once the whole tree is out
+  size_t copy;     // copies of node already exported (RBTREE_COUNTED)
+  rbtree_iter it;  // nodes after node, for trees without parent pointers
+} rbtree_cursor;
 
 int rbtree_to_array(const rbtree *, key_t *, const size_t);
+size_t rbtree_range_count(const rbtree *, const key_t, const key_t);
+size_t rbtree_range_to_array(const rbtree *, const key_t, const key_t, key_t *, const size_t);
+void rbtree_cursor_init(rbtree_cursor *, const rbtree *);
+size_t rbtree_to_array_next(const rbtree *, rbtree_cursor *, key_t *, const size_t);
+rbtree *rbtree_from_sorted(const key_t *, const size_t);
+#ifndef RBTREE_TOPDOWN
+int rbtree_split(rbtree *, const key_t, rbtree **, rbtree **);
+rbtree *rbtree_join(rbtree *, node_t *, rbtree *);
+
+// multiset set operations: the result is built in the first tree and the second
+// tree is consumed; independent subtrees are processed on up to `threads` threads
+rbtree *rbtree_union(rbtree *, rbtree *, const int);
+rbtree *rbtree_intersect(rbtree *, rbtree *, const int);
+rbtree *rbtree_difference(rbtree *, rbtree *, const int);
+#endif
+
+// versioned, checksummed sorted-key file; load bulk-builds from an mmap of it,
+// and the mapped mode answers lookups straight from the mapped array
+int rbtree_save(const rbtree *, const char *);
+rbtree *rbtree_load(const char *);
+rbtree_mapped *rbtree_mapped_open(const char *);
+void rbtree_mapped_close(rbtree_mapped *);
+size_t rbtree_mapped_size(const rbtree_mapped *);
+int rbtree_mapped_find(const rbtree_mapped *, const key_t);
+int rbtree_mapped_min(const rbtree_mapped *, key_t *);
+int rbtree_mapped_max(const rbtree_mapped *, key_t *);
+
+// frozen mode: freeze consumes the tree and lays its keys out as a read-only
+// B-ary Eytzinger array searched with AVX2 (scalar fallback); thaw rebuilds a tree
+rbtree_frozen *rbtree_freeze(rbtree *);
+rbtree *rbtree_thaw(rbtree_frozen *);
+void delete_rbtree_frozen(rbtree_frozen *);
+size_t rbtree_frozen_size(const rbtree_frozen *);
+int rbtree_frozen_find(const rbtree_frozen *, const key_t);
+int rbtree_frozen_lower_bound(const rbtree_frozen *, const key_t, key_t *);
+int rbtree_frozen_min(const rbtree_frozen *, key_t *);
+int rbtree_frozen_max(const rbtree_frozen *, key_t *);
 
 #endif  // _RBTREE_H_
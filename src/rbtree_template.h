@@ -0,0 +1,323 @@
+#ifndef _RBTREE_TEMPLATE_H_
+#define _RBTREE_TEMPLATE_H_
+
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+/*
+ * RBTREE_DEFINE(prefix, key_type, cmp)
+ *
+ * rbtree.c와 같은 알고리즘(CLRS, sentinel node)을 key 타입별로 찍어내는 매크로 템플릿.
+ * 비교는 cmp(a, b)를 직접 펼쳐 쓰므로 함수 포인터 호출이 없고,
+ * prefix가 다르면 여러 인스턴스가 한 바이너리에 함께 존재할 수 있다.
+ *
+ *   cmp(a, b): a < b 이면 음수, a == b 이면 0, a > b 이면 양수 (매크로 또는 inline 함수)
+ *
+ * 생성되는 타입과 함수 (rbtree.h의 같은 이름 함수와 동작이 같다)
+ *   prefix##_node, prefix##_tree
+ *   prefix##_new, prefix##_delete, prefix##_insert, prefix##_find,
+ *   prefix##_min, prefix##_max, prefix##_next, prefix##_prev,
+ *   prefix##_erase, prefix##_to_array
+ *
+ * 예) #define CMP_I64(a, b) (((a) > (b)) - ((a) < (b)))
+ *     RBTREE_DEFINE(i64tree, int64_t, CMP_I64)
+ */
+
+#define RBTREE_CMP_SCALAR(a, b) (((a) > (b)) - ((a) < (b)))
+
+#define RBTREE_DEFINE(prefix, key_type, cmp)                                   \
+  typedef struct prefix##_node {                                               \
+    color_t color;                                                             \
+    key_type key;                                                              \
+    struct prefix##_node *parent, *left, *right;                               \
+  } prefix##_node;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    prefix##_node *root;                                                       \
+    prefix##_node *nil;                                                        \
+  } prefix##_tree;                                                             \
+                                                                               \
+  static inline prefix##_tree *prefix##_new(void) {                            \
+    prefix##_tree *t = (prefix##_tree *)calloc(1, sizeof(prefix##_tree));      \
+    prefix##_node *nil = (prefix##_node *)calloc(1, sizeof(prefix##_node));    \
+    nil->color = RBTREE_BLACK;                                                 \
+    t->nil = nil;                                                              \
+    t->root = nil;                                                             \
+    return t;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_delete(prefix##_tree *t) {                       \
+    /* 재귀 대신 오른쪽 회전으로 펴 가며 해제 (추가 메모리 없이 O(n)) */       \
+    prefix##_node *x = t->root;                                                \
+    while (x != t->nil) {                                                      \
+      if (x->left != t->nil) {                                                 \
+        prefix##_node *l = x->left;                                            \
+        x->left = l->right;                                                    \
+        l->right = x;                                                          \
+        x = l;                                                                 \
+      } else {                                                                 \
+        prefix##_node *r = x->right;                                           \
+        free(x);                                                               \
+        x = r;                                                                 \
+      }                                                                        \
+    }                                                                          \
+    free(t->nil);                                                              \
+    free(t);                                                                   \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_left_rotate(prefix##_tree *t, prefix##_node *x) { \
+    prefix##_node *y = x->right;                                               \
+    x->right = y->left;                                                        \
+    if (y->left != t->nil)                                                     \
+      y->left->parent = x;                                                     \
+    y->parent = x->parent;                                                     \
+    if (x->parent == t->nil)                                                   \
+      t->root = y;                                                             \
+    else if (x == x->parent->left)                                             \
+      x->parent->left = y;                                                     \
+    else                                                                       \
+      x->parent->right = y;                                                    \
+    y->left = x;                                                               \
+    x->parent = y;                                                             \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_right_rotate(prefix##_tree *t, prefix##_node *x) { \
+    prefix##_node *y = x->left;                                                \
+    x->left = y->right;                                                        \
+    if (y->right != t->nil)                                                    \
+      y->right->parent = x;                                                    \
+    y->parent = x->parent;                                                     \
+    if (x->parent == t->nil)                                                   \
+      t->root = y;                                                             \
+    else if (x == x->parent->right)                                            \
+      x->parent->right = y;                                                    \
+    else                                                                       \
+      x->parent->left = y;                                                     \
+    y->right = x;                                                              \
+    x->parent = y;                                                             \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_insert_fixup(prefix##_tree *t, prefix##_node *z) { \
+    while (z != t->root && z->parent->color == RBTREE_RED) {                   \
+      prefix##_node *g = z->parent->parent;                                    \
+      if (g->left == z->parent) {                                              \
+        prefix##_node *y = g->right;                                           \
+        if (y->color == RBTREE_RED) {                                          \
+          z->parent->color = RBTREE_BLACK;                                     \
+          y->color = RBTREE_BLACK;                                             \
+          g->color = RBTREE_RED;                                               \
+          z = g;                                                               \
+        } else {                                                               \
+          if (z == z->parent->right) {                                         \
+            z = z->parent;                                                     \
+            prefix##_left_rotate(t, z);                                        \
+          }                                                                    \
+          z->parent->color = RBTREE_BLACK;                                     \
+          z->parent->parent->color = RBTREE_RED;                               \
+          prefix##_right_rotate(t, z->parent->parent);                         \
+        }                                                                      \
+      } else {                                                                 \
+        prefix##_node *y = g->left;                                            \
+        if (y->color == RBTREE_RED) {                                          \
+          z->parent->color = RBTREE_BLACK;                                     \
+          y->color = RBTREE_BLACK;                                             \
+          g->color = RBTREE_RED;                                               \
+          z = g;                                                               \
+        } else {                                                               \
+          if (z == z->parent->left) {                                          \
+            z = z->parent;                                                     \
+            prefix##_right_rotate(t, z);                                       \
+          }                                                                    \
+          z->parent->color = RBTREE_BLACK;                                     \
+          z->parent->parent->color = RBTREE_RED;                               \
+          prefix##_left_rotate(t, z->parent->parent);                          \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    t->root->color = RBTREE_BLACK;                                             \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_insert(prefix##_tree *t, const key_type key) { \
+    prefix##_node *z = (prefix##_node *)malloc(sizeof(prefix##_node));         \
+    z->key = key;                                                              \
+    z->left = t->nil;                                                          \
+    z->right = t->nil;                                                         \
+    z->color = RBTREE_RED;                                                     \
+    prefix##_node *cur = t->root;                                              \
+    prefix##_node *parent = t->nil;                                            \
+    int c = 0;                                                                 \
+    while (cur != t->nil) {                                                    \
+      parent = cur;                                                            \
+      c = cmp(key, cur->key);                                                  \
+      cur = c < 0 ? cur->left : cur->right;                                    \
+    }                                                                          \
+    z->parent = parent;                                                        \
+    if (parent == t->nil)                                                      \
+      t->root = z;                                                             \
+    else if (c < 0)                                                            \
+      parent->left = z;                                                        \
+    else                                                                       \
+      parent->right = z;                                                       \
+    prefix##_insert_fixup(t, z);                                               \
+    return z;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_find(const prefix##_tree *t, const key_type key) { \
+    prefix##_node *p = t->root;                                                \
+    while (p != t->nil) {                                                      \
+      int c = cmp(key, p->key);                                                \
+      if (c == 0)                                                              \
+        return p;                                                              \
+      p = c < 0 ? p->left : p->right;                                          \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_subtree_min(const prefix##_tree *t, prefix##_node *x) { \
+    while (x->left != t->nil)                                                  \
+      x = x->left;                                                             \
+    return x;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_subtree_max(const prefix##_tree *t, prefix##_node *x) { \
+    while (x->right != t->nil)                                                 \
+      x = x->right;                                                            \
+    return x;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_min(const prefix##_tree *t) {          \
+    return t->root == t->nil ? NULL : prefix##_subtree_min(t, t->root);        \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_max(const prefix##_tree *t) {          \
+    return t->root == t->nil ? NULL : prefix##_subtree_max(t, t->root);        \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_next(const prefix##_tree *t, const prefix##_node *x) { \
+    if (x->right != t->nil)                                                    \
+      return prefix##_subtree_min(t, x->right);                                \
+    prefix##_node *p = x->parent;                                              \
+    while (p != t->nil && x == p->right) {                                     \
+      x = p;                                                                   \
+      p = p->parent;                                                           \
+    }                                                                          \
+    return p == t->nil ? NULL : p;                                             \
+  }                                                                            \
+                                                                               \
+  static inline prefix##_node *prefix##_prev(const prefix##_tree *t, const prefix##_node *x) { \
+    if (x->left != t->nil)                                                     \
+      return prefix##_subtree_max(t, x->left);                                 \
+    prefix##_node *p = x->parent;                                              \
+    while (p != t->nil && x == p->left) {                                      \
+      x = p;                                                                   \
+      p = p->parent;                                                           \
+    }                                                                          \
+    return p == t->nil ? NULL : p;                                             \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_transplant(prefix##_tree *t, prefix##_node *u, prefix##_node *v) { \
+    if (u->parent == t->nil)                                                   \
+      t->root = v;                                                             \
+    else if (u == u->parent->left)                                             \
+      u->parent->left = v;                                                     \
+    else                                                                       \
+      u->parent->right = v;                                                    \
+    v->parent = u->parent;                                                     \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_erase_fixup(prefix##_tree *t, prefix##_node *x) { \
+    while (x != t->root && x->color == RBTREE_BLACK) {                         \
+      if (x == x->parent->left) {                                              \
+        prefix##_node *w = x->parent->right;                                   \
+        if (w->color == RBTREE_RED) {                                          \
+          w->color = RBTREE_BLACK;                                             \
+          x->parent->color = RBTREE_RED;                                       \
+          prefix##_left_rotate(t, x->parent);                                  \
+          w = x->parent->right;                                                \
+        }                                                                      \
+        if (w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK) { \
+          w->color = RBTREE_RED;                                               \
+          x = x->parent;                                                       \
+        } else {                                                               \
+          if (w->right->color == RBTREE_BLACK) {                               \
+            w->left->color = RBTREE_BLACK;                                     \
+            w->color = RBTREE_RED;                                             \
+            prefix##_right_rotate(t, w);                                       \
+            w = x->parent->right;                                              \
+          }                                                                    \
+          w->color = x->parent->color;                                         \
+          x->parent->color = RBTREE_BLACK;                                     \
+          w->right->color = RBTREE_BLACK;                                      \
+          prefix##_left_rotate(t, x->parent);                                  \
+          x = t->root;                                                         \
+        }                                                                      \
+      } else {                                                                 \
+        prefix##_node *w = x->parent->left;                                    \
+        if (w->color == RBTREE_RED) {                                          \
+          w->color = RBTREE_BLACK;                                             \
+          x->parent->color = RBTREE_RED;                                       \
+          prefix##_right_rotate(t, x->parent);                                 \
+          w = x->parent->left;                                                 \
+        }                                                                      \
+        if (w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK) { \
+          w->color = RBTREE_RED;                                               \
+          x = x->parent;                                                       \
+        } else {                                                               \
+          if (w->left->color == RBTREE_BLACK) {                                \
+            w->right->color = RBTREE_BLACK;                                    \
+            w->color = RBTREE_RED;                                             \
+            prefix##_left_rotate(t, w);                                        \
+            w = x->parent->left;                                               \
+          }                                                                    \
+          w->color = x->parent->color;                                         \
+          x->parent->color = RBTREE_BLACK;                                     \
+          w->left->color = RBTREE_BLACK;                                       \
+          prefix##_right_rotate(t, x->parent);                                 \
+          x = t->root;                                                         \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    x->color = RBTREE_BLACK;                                                   \
+  }                                                                            \
+                                                                               \
+  static inline int prefix##_erase(prefix##_tree *t, prefix##_node *z) {       \
+    prefix##_node *y = z;                                                      \
+    color_t y_original_color = y->color;                                       \
+    prefix##_node *x;                                                          \
+    if (z->left == t->nil) {                                                   \
+      x = z->right;                                                            \
+      prefix##_transplant(t, z, z->right);                                     \
+    } else if (z->right == t->nil) {                                           \
+      x = z->left;                                                             \
+      prefix##_transplant(t, z, z->left);                                      \
+    } else {                                                                   \
+      y = prefix##_subtree_min(t, z->right);                                   \
+      y_original_color = y->color;                                             \
+      x = y->right;                                                            \
+      if (y->parent == z)                                                      \
+        x->parent = y;                                                         \
+      else {                                                                   \
+        prefix##_transplant(t, y, y->right);                                   \
+        y->right = z->right;                                                   \
+        y->right->parent = y;                                                  \
+      }                                                                        \
+      prefix##_transplant(t, z, y);                                            \
+      y->left = z->left;                                                       \
+      y->left->parent = y;                                                     \
+      y->color = z->color;                                                     \
+    }                                                                          \
+    free(z);                                                                   \
+    if (y_original_color == RBTREE_BLACK)                                      \
+      prefix##_erase_fixup(t, x);                                              \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline size_t prefix##_to_array(const prefix##_tree *t, key_type *arr, const size_t n) { \
+    size_t i = 0;                                                              \
+    for (prefix##_node *x = prefix##_min(t); x != NULL && i < n; x = prefix##_next(t, x)) \
+      arr[i++] = x->key;                                                       \
+    return i;                                                                  \
+  }
+
+#endif  // _RBTREE_TEMPLATE_H_
@@ -1,8 +1,14 @@
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <rbtree.h>
+#include <rbtree_template.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // new_rbtree should return rbtree struct with null root node
 void test_init(void) {
@@ -26,13 +32,17 @@ void test_insert_single(const key_t key) {
   assert(p->key == key);
   // assert(p->color == RBTREE_BLACK);  // color of root node should be black
 #ifdef SENTINEL
-  assert(p->left == t->nil);
-  assert(p->right == t->nil);
-  assert(p->parent == t->nil);
+  assert(rbtree_left(p) == t->nil);
+  assert(rbtree_right(p) == t->nil);
+#ifndef RBTREE_TOPDOWN
+  assert(rbtree_parent(p) == t->nil);
+#endif
 #else
-  assert(p->left == NULL);
-  assert(p->right == NULL);
-  assert(p->parent == NULL);
+  assert(rbtree_left(p) == NULL);
+  assert(rbtree_right(p) == NULL);
+#ifndef RBTREE_TOPDOWN
+  assert(rbtree_parent(p) == NULL);
+#endif
 #endif
   delete_rbtree(t);
 }
@@ -191,11 +201,11 @@ static bool search_traverse(const node_t *p, key_t *min, key_t *max,
   key_t l_min, l_max, r_min, r_max;
   l_min = l_max = r_min = r_max = p->key;
 
-  const bool lr = search_traverse(p->left, &l_min, &l_max, nil);
+  const bool lr = search_traverse(rbtree_left(p), &l_min, &l_max, nil);
   if (!lr || l_max > p->key) {
     return false;
   }
-  const bool rr = search_traverse(p->right, &r_min, &r_max, nil);
+  const bool rr = search_traverse(rbtree_right(p), &r_min, &r_max, nil);
   if (!rr || r_min < p->key) {
     return false;
   }
@@ -243,12 +253,12 @@ static bool color_traverse(const node_t *p, const color_t parent_color,
     }
     return true;
   }
-  if (parent_color == RBTREE_RED && p->color == RBTREE_RED) {
+  if (parent_color == RBTREE_RED && rbtree_color(p) == RBTREE_RED) {
     return false;
   }
-  int next_depth = ((p->color == RBTREE_BLACK) ? 1 : 0) + black_depth;
-  return color_traverse(p->left, p->color, next_depth, nil) &&
-         color_traverse(p->right, p->color, next_depth, nil);
+  int next_depth = ((rbtree_color(p) == RBTREE_BLACK) ? 1 : 0) + black_depth;
+  return color_traverse(rbtree_left(p), rbtree_color(p), next_depth, nil) &&
+         color_traverse(rbtree_right(p), rbtree_color(p), next_depth, nil);
 }
 
 void test_color_constraint(const rbtree *t) {
@@ -259,12 +269,33 @@ void test_color_constraint(const rbtree *t) {
   node_t *nil = NULL;
 #endif
   node_t *p = t->root;
-  assert(p == nil || p->color == RBTREE_BLACK);
+  assert(p == nil || rbtree_color(p) == RBTREE_BLACK);
 
   init_color_traverse();
   assert(color_traverse(p, RBTREE_BLACK, 0, nil));
 }
 
+// Size constraint (RBTREE_ORDER_STAT)
+// The size of each node should be the number of nodes in its subtree
+
+#ifdef RBTREE_ORDER_STAT
+static size_t size_traverse(const node_t *p, const node_t *nil) {
+  if (p == nil) {
+    return 0;
+  }
+  const size_t size = size_traverse(rbtree_left(p), nil) + size_traverse(rbtree_right(p), nil) + rbtree_copies(p);
+  assert(p->size == size);
+  return size;
+}
+#endif
+
+// subtree sizes should match the tree contents
+void test_size_constraint(const rbtree *t) {
+#if defined(RBTREE_ORDER_STAT) && defined(SENTINEL)
+  assert(size_traverse(t->root, t->nil) == rbtree_size(t));
+#endif
+}
+
 // rbtree should keep search tree and color constraints
 void test_rb_constraints(const key_t arr[], const size_t n) {
   rbtree *t = new_rbtree();
@@ -367,17 +398,1813 @@ void test_find_erase_rand(const size_t n, const unsigned int seed) {
   delete_rbtree(t);
 }
 
-int main(void) {
-  test_init();
-  test_insert_single(1024);
-  test_find_single(512, 1024);
-  test_erase_root(128);
-  test_find_erase_fixed();
-  test_minmax_suite();
-  test_to_array_suite();
-  test_distinct_values();
-  test_duplicate_values();
-  test_multi_instance();
-  test_find_erase_rand(10000, 17);
+// next/prev should walk the tree in key order in both directions
+void test_next_prev(void) {
+  key_t entries[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
+  const size_t n = sizeof(entries) / sizeof(entries[0]);
+  rbtree *t = new_rbtree();
+  assert(rbtree_min(t) == NULL);
+  assert(rbtree_max(t) == NULL);
+  insert_arr(t, entries, n);
+  qsort((void *)entries, n, sizeof(key_t), comp);
+
+  // a node holds rbtree_copies(p) equal keys (more than one only in RBTREE_COUNTED builds)
+  node_t *p = rbtree_min(t);
+  for (int i = 0; i < n; i += rbtree_copies(p), p = rbtree_next(t, p)) {
+    assert(p != NULL);
+    assert(p->key == entries[i]);
+  }
+  assert(p == NULL);
+
+  p = rbtree_max(t);
+  for (int i = n - 1; i >= 0; i -= rbtree_copies(p), p = rbtree_prev(t, p)) {
+    assert(p != NULL);
+    assert(p->key == entries[i]);
+  }
+  assert(p == NULL);
+
+  delete_rbtree(t);
+}
+
+// find_batch should match a loop of rbtree_find, including partial groups and misses
+void test_find_batch(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *keys = calloc(n, sizeof(key_t));
+  node_t **out = calloc(n, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(t, rand() % (int)n);
+    keys[i] = rand() % (int)(2 * n) - 1;
+  }
+  for (size_t m = 0; m <= 40; m++) {
+    size_t hits = 0;
+    for (size_t i = 0; i < m; i++) {
+      hits += rbtree_find(t, keys[i]) != NULL;
+    }
+    assert(rbtree_find_batch(t, keys, m, out) == hits);
+    for (size_t i = 0; i < m; i++) {
+      assert(out[i] == rbtree_find(t, keys[i]));
+    }
+  }
+#ifdef RBTREE_STATS
+  rbtree_stats st;
+  rbtree_stats_reset(t);
+  for (size_t i = 0; i < n; i++) {
+    rbtree_find(t, keys[i]);
+  }
+  rbtree_stats_get(t, &st);
+  const size_t cmps = st.comparisons;
+  rbtree_stats_reset(t);
+  rbtree_find_batch(t, keys, n, out);
+  rbtree_stats_get(t, &st);
+  assert(st.comparisons == cmps);
+#endif
+  size_t hits = rbtree_find_batch(t, keys, n, out);
+  for (size_t i = 0; i < n; i++) {
+    assert(out[i] == rbtree_find(t, keys[i]));
+    hits -= out[i] != NULL;
+  }
+  assert(hits == 0);
+
+  rbtree *e = new_rbtree();
+  assert(rbtree_find_batch(e, keys, 20, out) == 0 && out[0] == NULL && out[19] == NULL);
+  delete_rbtree(e);
+  free(out);
+  free(keys);
+  delete_rbtree(t);
+}
+
+// to_array should not write past n and chunked export should resume
+void test_to_array_bounded(void) {
+  key_t entries[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24, 36, 990, 25};
+  const size_t n = sizeof(entries) / sizeof(entries[0]);
+  rbtree *t = new_rbtree();
+  insert_arr(t, entries, n);
+  qsort((void *)entries, n, sizeof(key_t), comp);
+
+  key_t small[5] = {0, 0, 0, 0, -1};
+  rbtree_to_array(t, small, 4);
+  for (int i = 0; i < 4; i++) {
+    assert(small[i] == entries[i]);
+  }
+  assert(small[4] == -1);
+
+  key_t buf[3];
+  size_t total = 0;
+  rbtree_cursor cur;
+  rbtree_cursor_init(&cur, t);
+  while (cur.node != NULL) {
+    size_t got = rbtree_to_array_next(t, &cur, buf, 3);
+    assert(got > 0 && got <= 3);
+    for (size_t i = 0; i < got; i++) {
+      assert(buf[i] == entries[total + i]);
+    }
+    total += got;
+  }
+  assert(total == n);
+
+  delete_rbtree(t);
+}
+
+// chunked export covers every copy of a key even when its node does not fit in what is left of the buffer,
+// and also works on copy-on-write trees, which have no parent pointers
+void test_to_array_chunks(void) {
+  const key_t entries[] = {10, 20, 30, 30, 40, 50, 60, 60, 60, 60, 60, 60, 60, 70};
+  const size_t n = sizeof(entries) / sizeof(entries[0]);
+  key_t out[sizeof(entries) / sizeof(entries[0])];
+  for (int cow = 0; cow < 2; cow++) {
+    rbtree *t = cow ? new_rbtree_cow() : new_rbtree();
+    for (size_t i = 0; i < n; i++) {
+      rbtree_insert(t, entries[i]);
+    }
+    for (size_t chunk = 1; chunk <= 5; chunk++) {
+      key_t buf[5];
+      size_t total = 0;
+      rbtree_cursor cur;
+      rbtree_cursor_init(&cur, t);
+      while (cur.node != NULL) {
+        size_t got = rbtree_to_array_next(t, &cur, buf, chunk);
+        assert(got > 0 && got <= chunk);
+        assert(total + got <= n);
+        memcpy(out + total, buf, got * sizeof(key_t));
+        total += got;
+      }
+      assert(total == n);
+      assert(memcmp(out, entries, n * sizeof(key_t)) == 0);
+      assert(rbtree_to_array_next(t, &cur, buf, chunk) == 0);
+    }
+    delete_rbtree(t);
+  }
+}
+
+// from_sorted should build a valid tree that round-trips through to_array
+void test_from_sorted(const size_t max_n) {
+  for (size_t n = 0; n <= max_n; n++) {
+    key_t *arr = calloc(n + 1, sizeof(key_t));
+    for (size_t i = 0; i < n; i++) {
+      arr[i] = (key_t)(i / 2);  // with duplicates
+    }
+    rbtree *t = rbtree_from_sorted(arr, n);
+    assert(t != NULL);
+    test_color_constraint(t);
+    test_search_constraint(t);
+
+    key_t *res = calloc(n + 1, sizeof(key_t));
+    rbtree_to_array(t, res, n);
+    for (size_t i = 0; i < n; i++) {
+      assert(res[i] == arr[i]);
+    }
+
+    // the tree must stay usable after a bulk load
+    if (n > 0) {
+      rbtree_erase(t, rbtree_min(t));
+      rbtree_insert(t, -1);
+      assert(rbtree_min(t)->key == -1);
+      test_color_constraint(t);
+      test_search_constraint(t);
+    }
+
+    free(res);
+    free(arr);
+    delete_rbtree(t);
+  }
+}
+
+// apply_batch should give the same results as applying the ops one by one
+void test_apply_batch(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  rbtree *ref = new_rbtree();
+  for (int i = 0; i < n; i++) {
+    const key_t key = rand() % 500;
+    rbtree_insert(t, key);
+    rbtree_insert(ref, key);
+  }
+
+  rbtree_batch_op *ops = calloc(n, sizeof(rbtree_batch_op));
+  for (int i = 0; i < n; i++) {
+    ops[i].op = (rbtree_op_t)(rand() % 3);
+    ops[i].key = rand() % 600;
+  }
+  assert(rbtree_apply_batch(t, ops, n) == 0);
+
+  size_t size = n;
+  for (int i = 0; i < n; i++) {
+    node_t *p = rbtree_find(ref, ops[i].key);
+    assert(ops[i].found == (p != NULL));
+    switch (ops[i].op) {
+      case RBTREE_OP_INSERT:
+        assert(ops[i].node != NULL);
+        rbtree_insert(ref, ops[i].key);
+        size++;
+        break;
+      case RBTREE_OP_FIND:
+        assert((ops[i].node != NULL) == (p != NULL));
+        break;
+      case RBTREE_OP_ERASE:
+        assert(ops[i].node == NULL);
+        if (p != NULL) {
+          rbtree_erase(ref, p);
+          size--;
+        }
+        break;
+    }
+  }
+
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  assert(rbtree_size(t) == size);
+  key_t *res = calloc(size, sizeof(key_t));
+  key_t *expected = calloc(size, sizeof(key_t));
+  rbtree_to_array(t, res, size);
+  rbtree_to_array(ref, expected, size);
+  for (int i = 0; i < size; i++) {
+    assert(res[i] == expected[i]);
+  }
+
+  free(expected);
+  free(res);
+  free(ops);
+  delete_rbtree(ref);
+  delete_rbtree(t);
+}
+
+// select/rank/size should agree with the sorted contents of the tree
+void test_order_statistic(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2 + 1);
+  }
+  insert_arr(t, arr, n);
+
+  // erase every third key so the sizes also go through erase fixups
+  size_t m = 0;
+  for (int i = 0; i < n; i++) {
+    if (i % 3 == 0) {
+      rbtree_erase(t, rbtree_find(t, arr[i]));
+    } else {
+      arr[m++] = arr[i];
+    }
+  }
+  qsort((void *)arr, m, sizeof(key_t), comp);
+  assert(rbtree_size(t) == m);
+  test_size_constraint(t);
+
+  for (size_t k = 0; k < m; k++) {
+    node_t *p = rbtree_select(t, k);
+    assert(p != NULL);
+    assert(p->key == arr[k]);
+  }
+  assert(rbtree_select(t, m) == NULL);
+
+  size_t lo = 0;
+  for (key_t key = -1; key <= (key_t)(n / 2 + 2); key++) {
+    while (lo < m && arr[lo] < key) {
+      lo++;
+    }
+    assert(rbtree_rank(t, key) == lo);
+  }
+
+  rbtree *u = rbtree_from_sorted(arr, m);
+  assert(rbtree_size(u) == m);
+  test_size_constraint(u);
+  assert(rbtree_select(u, m / 2)->key == arr[m / 2]);
+  delete_rbtree(u);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+// lower/upper bound should return the leftmost match and ranges should be [lo, hi)
+void test_range(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 4 + 1);
+  }
+  insert_arr(t, arr, n);
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  key_t *out = calloc(n, sizeof(key_t));
+  size_t lb = 0, ub = 0;
+  for (key_t key = -1; key <= (key_t)(n / 4 + 2); key++) {
+    while (lb < n && arr[lb] < key) {
+      lb++;
+    }
+    while (ub < n && arr[ub] <= key) {
+      ub++;
+    }
+    node_t *p = rbtree_lower_bound(t, key);
+    node_t *q = rbtree_upper_bound(t, key);
+    if (lb == n) {
+      assert(p == NULL);
+    } else {
+      assert(p != NULL && p->key == arr[lb]);
+      // leftmost duplicate: nothing before it has the same key
+      assert(rbtree_prev(t, p) == NULL || rbtree_prev(t, p)->key < key);
+    }
+    if (ub == n) {
+      assert(q == NULL);
+    } else {
+      assert(q != NULL && q->key == arr[ub]);
+      assert(rbtree_prev(t, q) == NULL || rbtree_prev(t, q)->key <= key);
+    }
+
+    const key_t hi = key + 3;
+    size_t cnt = 0;
+    while (lb + cnt < n && arr[lb + cnt] < hi) {
+      cnt++;
+    }
+    assert(rbtree_range_count(t, key, hi) == cnt);
+    assert(rbtree_range_to_array(t, key, hi, out, n) == cnt);
+    for (size_t i = 0; i < cnt; i++) {
+      assert(out[i] == arr[lb + i]);
+    }
+    if (cnt > 1) {
+      assert(rbtree_range_to_array(t, key, hi, out, 1) == 1);
+      assert(out[0] == arr[lb]);
+    }
+  }
+  assert(rbtree_range_count(t, 5, 5) == 0);
+  assert(rbtree_range_to_array(t, 5, 2, out, n) == 0);
+
+  free(out);
+  free(arr);
+  delete_rbtree(t);
+}
+
+typedef struct {
+  int32_t major;
+  int32_t minor;
+} version_key;
+
+#define VERSION_CMP(a, b)                                                      \
+  ((a).major != (b).major ? RBTREE_CMP_SCALAR((a).major, (b).major)            \
+                          : RBTREE_CMP_SCALAR((a).minor, (b).minor))
+
+RBTREE_DEFINE(i64tree, int64_t, RBTREE_CMP_SCALAR)
+RBTREE_DEFINE(dbltree, double, RBTREE_CMP_SCALAR)
+RBTREE_DEFINE(vertree, version_key, VERSION_CMP)
+
+static int comp_i64(const void *p1, const void *p2) {
+  return RBTREE_CMP_SCALAR(*(const int64_t *)p1, *(const int64_t *)p2);
+}
+
+// trees generated by RBTREE_DEFINE should behave like the int tree
+void test_template_i64(const size_t n, const unsigned int seed) {
+  srand(seed);
+  i64tree_tree *t = i64tree_new();
+  int64_t *arr = calloc(n, sizeof(int64_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = ((int64_t)rand() << 32) - rand();
+    i64tree_insert(t, arr[i]);
+  }
+
+  for (int i = 0; i < n; i += 2) {
+    i64tree_node *p = i64tree_find(t, arr[i]);
+    assert(p != NULL && p->key == arr[i]);
+    i64tree_erase(t, p);
+  }
+  size_t m = 0;
+  for (int i = 1; i < n; i += 2) {
+    arr[m++] = arr[i];
+  }
+  qsort((void *)arr, m, sizeof(int64_t), comp_i64);
+
+  int64_t *res = calloc(m, sizeof(int64_t));
+  assert(i64tree_to_array(t, res, m) == m);
+  for (int i = 0; i < m; i++) {
+    assert(res[i] == arr[i]);
+  }
+  assert(i64tree_min(t)->key == arr[0]);
+  assert(i64tree_max(t)->key == arr[m - 1]);
+  assert(i64tree_prev(t, i64tree_max(t))->key == arr[m - 2]);
+
+  free(res);
+  free(arr);
+  i64tree_delete(t);
+}
+
+void test_template_other_keys(void) {
+  dbltree_tree *d = dbltree_new();
+  const double dkeys[] = {2.5, -1.0, 3.75, 0.125, 2.5, 1e10};
+  const double dsorted[] = {-1.0, 0.125, 2.5, 2.5, 3.75, 1e10};
+  for (int i = 0; i < 6; i++) {
+    dbltree_insert(d, dkeys[i]);
+  }
+  double dres[6];
+  assert(dbltree_to_array(d, dres, 6) == 6);
+  for (int i = 0; i < 6; i++) {
+    assert(dres[i] == dsorted[i]);
+  }
+  assert(dbltree_find(d, 0.125) != NULL);
+  assert(dbltree_find(d, 0.25) == NULL);
+  dbltree_delete(d);
+
+  vertree_tree *v = vertree_new();
+  const version_key vkeys[] = {{1, 2}, {0, 9}, {1, 0}, {2, 0}, {1, 10}};
+  for (int i = 0; i < 5; i++) {
+    vertree_insert(v, vkeys[i]);
+  }
+  vertree_node *p = vertree_min(v);
+  assert(p->key.major == 0 && p->key.minor == 9);
+  p = vertree_next(v, p);
+  assert(p->key.major == 1 && p->key.minor == 0);
+  p = vertree_next(v, p);
+  assert(p->key.major == 1 && p->key.minor == 2);
+  p = vertree_next(v, p);
+  assert(p->key.major == 1 && p->key.minor == 10);
+  vertree_erase(v, vertree_find(v, (version_key){1, 2}));
+  assert(vertree_find(v, (version_key){1, 2}) == NULL);
+  assert(vertree_max(v)->key.major == 2);
+  vertree_delete(v);
+}
+
+typedef struct {
+  int64_t hits;
+  char name[12];
+} record;
+
+// map trees should keep a value next to every key and upsert in place
+void test_map(const size_t n) {
+  rbtree *t = new_rbtree_map(sizeof(record), 0);
+  assert(t != NULL);
+
+  for (int i = 0; i < n; i++) {
+    record r = {i, ""};
+    snprintf(r.name, sizeof(r.name), "k%d", i);
+    node_t *p = rbtree_map_insert(t, (key_t)(i * 7 % n), &r);
+    assert(p != NULL);
+    assert(((record *)rbtree_map_value(p))->hits == i);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+
+  for (int i = 0; i < n; i++) {
+    record *r = rbtree_map_get(t, (key_t)(i * 7 % n));
+    assert(r != NULL);
+    assert(r->hits == i);
+  }
+  assert(rbtree_map_get(t, (key_t)n) == NULL);
+
+  // upsert overwrites existing keys without adding nodes
+  for (int i = 0; i < n; i += 2) {
+    record r = {-i, "updated"};
+    node_t *p = rbtree_map_upsert(t, (key_t)i, &r);
+    assert(p != NULL && p->key == i);
+  }
+  assert(rbtree_size(t) == n);
+  for (int i = 0; i < n; i += 2) {
+    record *r = rbtree_map_get(t, (key_t)i);
+    assert(r->hits == -i);
+    assert(r->name[0] == 'u');
+  }
+
+  // upsert adds missing keys
+  record r = {42, "new"};
+  node_t *p = rbtree_map_upsert(t, -5, &r);
+  assert(p != NULL && rbtree_min(t) == p);
+  assert(rbtree_size(t) == n + 1);
+  assert(((record *)rbtree_map_get(t, -5))->hits == 42);
+
+  // values travel with their nodes through erase fixups
+  for (int i = 1; i < n; i += 2) {
+    rbtree_erase(t, rbtree_find(t, (key_t)i));
+  }
+  test_color_constraint(t);
+  for (int i = 0; i < n; i += 2) {
+    assert(((record *)rbtree_map_get(t, (key_t)i))->hits == -i);
+  }
+
+  // a duplicate key gets its own value, or is refused where copies share one node
+  const size_t before = rbtree_size(t);
+  record dup = {7, "dup"};
+  p = rbtree_map_insert(t, 0, &dup);
+#ifdef RBTREE_COUNTED
+  assert(p == NULL && rbtree_size(t) == before);
+#else
+  assert(p != NULL && ((record *)rbtree_map_value(p))->hits == 7);
+  assert(rbtree_size(t) == before + 1);
+#endif
+  // the value already stored under the key is left alone
+  int kept = 0;
+  for (node_t *q = rbtree_lower_bound(t, 0); q != NULL && q->key == 0; q = rbtree_next(t, q)) {
+    kept += ((record *)rbtree_map_value(q))->name[0] == 'u';
+  }
+  assert(kept == 1);
+
+  delete_rbtree(t);
+}
+
+#if !defined(RBTREE_INDEX32) && !defined(RBTREE_TOPDOWN)
+typedef struct {
+  int id;
+  rb_link link;
+  int check;
+} pooled_item;
+
+// intrusive trees should link caller-owned nodes without allocating
+void test_intrusive(const size_t n) {
+  rbtree *t = new_rbtree_intrusive();
+  pooled_item *pool = calloc(n, sizeof(pooled_item));
+  for (int i = 0; i < n; i++) {
+    pool[i].id = i;
+    pool[i].check = -i;
+    pool[i].link.key = (key_t)((i * 37) % n);
+    node_t *p = rbtree_link(t, &pool[i].link);
+    assert(p == &pool[i].link);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(rbtree_size(t) == n);
+
+  for (int i = 0; i < n; i += 2) {
+    rbtree_unlink(t, &pool[i].link);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(rbtree_size(t) == n / 2);
+
+  key_t prev = -1;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    pooled_item *item = rbtree_entry(p, pooled_item, link);
+    assert(item->id % 2 == 1);
+    assert(item->check == -item->id);
+    assert(p->key > prev);
+    prev = p->key;
+  }
+
+  node_t *p = rbtree_find(t, pool[1].link.key);
+  assert(rbtree_entry(p, pooled_item, link) == &pool[1]);
+
+  // unlinked items can be linked again
+  rbtree_link(t, &pool[0].link);
+  assert(rbtree_find(t, pool[0].link.key) == &pool[0].link);
+
+  // erase only unlinks the caller's links, and nothing can allocate a node here
+  assert(rbtree_erase_key(t, pool[0].link.key) == 1);
+  assert(rbtree_erase(t, &pool[1].link) == 0);
+  rbtree_batch_op ops[2] = {{.op = RBTREE_OP_ERASE, .key = pool[3].link.key},
+                            {.op = RBTREE_OP_INSERT, .key = 5}};
+  assert(rbtree_apply_batch(t, ops, 1) == 0 && ops[0].found);
+  assert(rbtree_apply_batch(t, ops + 1, 1) == -1);
+  assert(rbtree_erase_range(t, pool[5].link.key, pool[5].link.key + 1) == 1);
+  assert(rbtree_size(t) == n / 2 - 3);
+  assert(rbtree_insert(t, 5) == NULL && rbtree_insert_unique(t, 5, NULL) == NULL);
+  assert(rbtree_insert_hint(t, NULL, 5) == NULL);
+  assert(rbtree_size(t) == n / 2 - 3);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(pool[1].check == -1 && pool[3].check == -3);
+
+  delete_rbtree(t);  // must not free the pool's links
+  free(pool);
+}
+#endif
+
+// memory usage should cover every node, and index mode nodes are 16 bytes
+void test_memory_usage(const size_t n) {
+#if defined(RBTREE_INDEX32) && !defined(RBTREE_ORDER_STAT)
+  assert(sizeof(node_t) == 16);
+#endif
+#if defined(RBTREE_TOPDOWN) && !defined(RBTREE_COUNTED)
+  assert(sizeof(node_t) == 24);
+#endif
+  rbtree *t = new_rbtree();
+  const size_t empty = rbtree_memory_usage(t);
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, i);
+  }
+  assert(rbtree_memory_usage(t) >= empty + n * sizeof(node_t));
+  delete_rbtree(t);
+
+  rbtree *u = new_rbtree_sized(n);
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(u, i);
+  }
+  assert(rbtree_memory_usage(u) >= n * u->node_size);
+  delete_rbtree(u);
+}
+
+// arena-backed trees should behave like malloc-backed ones and reuse nodes
+void test_sized_tree(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree_sized(n / 4);
+  assert(t != NULL);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 1000;
+  }
+
+  test_find_erase(t, arr, n);
+#ifdef SENTINEL
+  assert(t->root == t->nil);
+#endif
+
+  insert_arr(t, arr, n);
+  test_color_constraint(t);
+  test_search_constraint(t);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  for (int i = 0; i < n; i++) {
+    assert(arr[i] == res[i]);
+  }
+
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// readers must always see the stable keys (multiples of 4) while a writer
+// keeps inserting and erasing keys in between
+#define SYNC_READERS 4
+
+typedef struct {
+  rbtree_sync *s;
+  int n;
+  volatile int *stop;
+} sync_arg;
+
+static void *sync_reader(void *p) {
+  sync_arg *a = p;
+  key_t *buf = calloc(64, sizeof(key_t));
+  unsigned int seed = 7;
+  while (!*a->stop) {
+    const key_t k = 4 * (rand_r(&seed) % a->n);
+    assert(rbtree_sync_find(a->s, k));
+    assert(!rbtree_sync_find(a->s, k + 2));
+
+    key_t lo, hi;
+    assert(rbtree_sync_min(a->s, &lo) && lo == 0);
+    assert(rbtree_sync_max(a->s, &hi) && hi == 4 * (a->n - 1));
+
+    const size_t cnt = rbtree_sync_range(a->s, k, k + 64, buf, 64);
+    size_t stable = 0;
+    for (size_t i = 0; i < cnt; i++) {
+      assert(i == 0 || buf[i - 1] <= buf[i]);
+      assert(buf[i] >= k && buf[i] < k + 64);
+      stable += buf[i] % 4 == 0;
+    }
+    const int expect = k + 64 <= 4 * (a->n - 1) ? 16 : (4 * (a->n - 1) - k) / 4 + 1;
+    assert(stable == expect);
+  }
+  free(buf);
+  return NULL;
+}
+
+void test_sync(const int n, const int rounds) {
+  rbtree_sync *s = new_rbtree_sync(n);
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_sync_insert(s, 4 * i) == 0);
+  }
+
+  volatile int stop = 0;
+  sync_arg arg = {s, n, &stop};
+  pthread_t readers[SYNC_READERS];
+  for (int i = 0; i < SYNC_READERS; i++) {
+    pthread_create(&readers[i], NULL, sync_reader, &arg);
+  }
+
+  srand(43);
+  for (int r = 0; r < rounds; r++) {
+    const key_t k = 4 * (rand() % (n - 1)) + 1;
+    if (rbtree_sync_find(s, k)) {
+      assert(rbtree_sync_erase(s, k) == 1);
+    } else {
+      assert(rbtree_sync_insert(s, k) == 0);
+    }
+  }
+  stop = 1;
+  for (int i = 0; i < SYNC_READERS; i++) {
+    pthread_join(readers[i], NULL);
+  }
+
+  rbtree *t = rbtree_sync_write_lock(s);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  rbtree_sync_write_unlock(s);
+  assert(!rbtree_sync_erase(s, 2));
+  delete_rbtree_sync(s);
+}
+
+// concurrent inserts into a sharded container, including a skewed key range
+// that forces shard boundaries to move, must keep every key findable and ordered
+#define SHARD_WRITERS 4
+
+typedef struct {
+  rbtree_sharded *s;
+  int id, n;
+} shard_arg;
+
+static void *shard_writer(void *p) {
+  shard_arg *a = p;
+  for (int i = a->id; i < a->n; i += SHARD_WRITERS) {
+    // half the keys are spread over the whole range, half fall into one shard
+    const key_t key = i % 2 ? (key_t)((unsigned)i * 2654435761u) : i;
+    assert(rbtree_sharded_insert(a->s, key) == 0);
+  }
+  return NULL;
+}
+
+void test_sharded(const int n, const size_t shards) {
+  rbtree_sharded *s = new_rbtree_sharded(shards);
+  key_t k;
+  assert(!rbtree_sharded_min(s, &k) && !rbtree_sharded_max(s, &k));
+
+  pthread_t writers[SHARD_WRITERS];
+  shard_arg args[SHARD_WRITERS];
+  for (int i = 0; i < SHARD_WRITERS; i++) {
+    args[i] = (shard_arg){s, i, n};
+    pthread_create(&writers[i], NULL, shard_writer, &args[i]);
+  }
+  for (int i = 0; i < SHARD_WRITERS; i++) {
+    pthread_join(writers[i], NULL);
+  }
+  assert(rbtree_sharded_size(s) == n);
+
+  key_t *expect = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    expect[i] = i % 2 ? (key_t)((unsigned)i * 2654435761u) : i;
+    assert(rbtree_sharded_find(s, expect[i]));
+  }
+  qsort(expect, n, sizeof(key_t), comp);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  assert(rbtree_sharded_to_array(s, res, n) == n);
+  for (int i = 0; i < n; i++) {
+    assert(res[i] == expect[i]);
+  }
+  assert(rbtree_sharded_min(s, &k) && k == expect[0]);
+  assert(rbtree_sharded_max(s, &k) && k == expect[n - 1]);
+
+  for (int i = 0; i < n; i += 2) {
+    assert(rbtree_sharded_erase(s, i));
+    assert(!rbtree_sharded_find(s, i));
+  }
+  assert(rbtree_sharded_size(s) == n / 2);
+
+  free(res);
+  free(expect);
+  delete_rbtree_sharded(s);
+}
+
+static void *shard_dup_writer(void *p) {
+  shard_arg *a = p;
+  for (int i = a->id; i < a->n; i += SHARD_WRITERS) {
+    // three keys out of four are one hot key, the rest a few small runs
+    const key_t key = i % 4 ? 7 : i % 64;
+    assert(rbtree_sharded_insert(a->s, key) == 0);
+  }
+  return NULL;
+}
+
+// runs of equal keys cannot be split between shards, so rebalancing must give up instead of bouncing them
+void test_sharded_dups(const int n) {
+  rbtree_sharded *s = new_rbtree_sharded(2);
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_sharded_insert(s, 7) == 0);
+  }
+  assert(rbtree_sharded_size(s) == n);
+  delete_rbtree_sharded(s);
+
+  for (size_t shards = 2; shards <= 8; shards *= 2) {
+    s = new_rbtree_sharded(shards);
+    pthread_t writers[SHARD_WRITERS];
+    shard_arg args[SHARD_WRITERS];
+    for (int i = 0; i < SHARD_WRITERS; i++) {
+      args[i] = (shard_arg){s, i, n};
+      pthread_create(&writers[i], NULL, shard_dup_writer, &args[i]);
+    }
+    for (int i = 0; i < SHARD_WRITERS; i++) {
+      pthread_join(writers[i], NULL);
+    }
+    assert(rbtree_sharded_size(s) == n);
+
+    key_t *expect = calloc(n, sizeof(key_t));
+    key_t *res = calloc(n, sizeof(key_t));
+    for (int i = 0; i < n; i++) {
+      expect[i] = i % 4 ? 7 : i % 64;
+    }
+    qsort(expect, n, sizeof(key_t), comp);
+    assert(rbtree_sharded_to_array(s, res, n) == n);
+    assert(memcmp(res, expect, n * sizeof(key_t)) == 0);
+    for (int i = 0; i < n / 2; i++) {
+      assert(rbtree_sharded_erase(s, 7));
+    }
+    assert(rbtree_sharded_size(s) == n - n / 2);
+    free(res);
+    free(expect);
+    delete_rbtree_sharded(s);
+  }
+}
+
+// copy-on-write trees should behave like normal trees for a single thread
+void test_cow_basic(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree_cow();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2);
+    assert(rbtree_insert(t, arr[i]) != NULL);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  assert(rbtree_size(t) == n);
+
+  qsort(arr, n, sizeof(key_t), comp);
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(res[i] == arr[i]);
+  }
+  assert(rbtree_min(t)->key == arr[0]);
+  assert(rbtree_max(t)->key == arr[n - 1]);
+
+  // erase every other key, then the rest
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = pass; i < n; i += 2) {
+      node_t *p = rbtree_find(t, arr[i]);
+      assert(p != NULL);
+      assert(rbtree_erase(t, p) == 0);
+    }
+    test_color_constraint(t);
+    test_search_constraint(t);
+    test_size_constraint(t);
+  }
+  assert(rbtree_size(t) == 0);
+  assert(rbtree_min(t) == NULL);
+  assert(rbtree_cow_retired(t) == 0);
+
+  // operations that would write into shared nodes in place are rejected and leave the tree alone
+  rbtree_insert(t, 1);
+  rbtree_batch_op op = {.op = RBTREE_OP_INSERT, .key = 2};
+  assert(rbtree_apply_batch(t, &op, 1) == -1);
+  op.op = RBTREE_OP_FIND;
+  assert(rbtree_apply_batch(t, &op, 1) == -1);
+  assert(rbtree_map_upsert(t, 1, NULL) == NULL && rbtree_map_upsert(t, 3, NULL) == NULL);
+#if !defined(RBTREE_INDEX32) && !defined(RBTREE_TOPDOWN)
+  rb_link link = {.key = 4};
+  assert(rbtree_link(t, &link) == NULL);
+#endif
+  assert(rbtree_size(t) == 1 && rbtree_find(t, 2) == NULL && rbtree_find(t, 4) == NULL);
+  test_color_constraint(t);
+
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// a pinned reader keeps seeing its version while the writer replaces it,
+// and the replaced nodes are reclaimed only after the reader leaves
+void test_cow_snapshot(const size_t n) {
+  rbtree *t = new_rbtree_cow();
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, i);
+  }
+  const int slot = rbtree_cow_reader_add(t);
+  assert(slot >= 0);
+  rbtree_cow_read_lock(t, slot);
+  rbtree old = *t;
+
+  for (int i = 0; i < n; i++) {
+    rbtree_erase(t, rbtree_find(t, i));
+    rbtree_insert(t, n + i);
+  }
+  assert(rbtree_cow_retired(t) > 0);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(&old, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(res[i] == i);
+  }
+  test_color_constraint(&old);
+  rbtree_to_array(t, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(res[i] == n + i);
+  }
+
+  rbtree_cow_read_unlock(t, slot);
+  rbtree_insert(t, 2 * n);
+  assert(rbtree_cow_retired(t) == 0);
+  rbtree_cow_reader_remove(t, slot);
+  free(res);
+  delete_rbtree(t);
+}
+
+// a snapshot keeps its contents while the live tree is rewritten,
+// and its nodes are reclaimed once it is released
+void test_snapshot(const int n) {
+  rbtree *plain = new_rbtree();
+  assert(rbtree_snapshot(plain) == NULL);
+  for (int i = n; i > 0; i--) {
+    rbtree_insert(plain, i % 7);
+  }
+  rbtree_iter it;
+  rbtree_iter_init(&it, plain);
+  key_t prev = -1;
+  int cnt = 0;
+  for (node_t *p = rbtree_iter_next(&it); p != NULL; p = rbtree_iter_next(&it)) {
+    assert(p->key >= prev);
+    prev = p->key;
+    cnt += rbtree_copies(p);
+  }
+  assert(cnt == n);
+  delete_rbtree(plain);
+
+  rbtree *t = new_rbtree_cow();
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, 2 * i);
+  }
+  rbtree_snapshot_t *snap = rbtree_snapshot(t);
+  assert(snap != NULL);
+  const rbtree *v = rbtree_snapshot_view(snap);
+
+  for (int i = 0; i < n; i++) {
+    rbtree_erase(t, rbtree_find(t, 2 * i));
+    rbtree_insert(t, 2 * i + 1);
+  }
+  assert(rbtree_size(t) == n && rbtree_size(v) == n);
+  assert(rbtree_find(v, 2) != NULL && rbtree_find(v, 3) == NULL);
+  assert(rbtree_find(t, 2) == NULL && rbtree_find(t, 3) != NULL);
+  assert(rbtree_min(v)->key == 0 && rbtree_max(v)->key == 2 * (n - 1));
+
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(v, res, n);
+  rbtree_iter_init(&it, v);
+  for (int i = 0; i < n; i++) {
+    assert(res[i] == 2 * i);
+    assert(rbtree_iter_next(&it)->key == 2 * i);
+  }
+  assert(rbtree_iter_next(&it) == NULL);
+  test_color_constraint(v);
+
+  assert(rbtree_cow_retired(t) > 0);
+  rbtree_snapshot_release(snap);
+  rbtree_insert(t, -1);
+  assert(rbtree_cow_retired(t) == 0);
+  free(res);
+  delete_rbtree(t);
+}
+
+// check that t holds exactly keys[lo, hi) and is a valid red-black tree
+static void check_tree_keys(const rbtree *t, const key_t *keys, const size_t lo, const size_t hi) {
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  assert(rbtree_size(t) == hi - lo);
+  key_t *res = calloc(hi - lo + 1, sizeof(key_t));
+  rbtree_to_array(t, res, hi - lo);
+  for (size_t i = lo; i < hi; i++) {
+    assert(res[i - lo] == keys[i]);
+  }
+  free(res);
+}
+
+// insert_hint lands keys correctly from any hint, and appends without descending
+void test_insert_hint(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+
+  // ascending keys (with repeats) and no hint: each lands right of the cached max
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = (key_t)(i / 3);
+    rbtree_insert_hint(t, NULL, arr[i]);
+  }
+  check_tree_keys(t, arr, 0, n);
+#if defined(RBTREE_STATS) && !defined(RBTREE_TOPDOWN)
+  rbtree_stats st;
+  rbtree_stats_reset(t);
+  for (size_t i = 0; i < 100; i++) {
+    rbtree_insert_hint(t, NULL, (key_t)(n + i));
+  }
+  rbtree_stats_get(t, &st);
+  assert(st.comparisons <= 100);
+#endif
+  delete_rbtree(t);
+
+  // nearly sorted keys, hinting with the previously inserted node
+  t = new_rbtree();
+  node_t *hint = NULL;
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = (key_t)i + rand() % 16 - 8;
+    hint = rbtree_insert_hint(t, hint, arr[i]);
+    assert(hint != NULL && hint->key == arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+  check_tree_keys(t, arr, 0, n);
+  delete_rbtree(t);
+
+  // random keys from random hints, with erases (and split/join) in between
+  t = new_rbtree();
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = rand() % (int)(n / 4);
+    node_t *h = m > 0 ? nodes[rand() % m] : NULL;
+    nodes[m++] = rbtree_insert_hint(t, h, arr[i]);
+    if (i % 64 == 63) {
+      // the max may be erased: hints and the cached max must not point at it afterwards
+      rbtree_erase(t, rbtree_max(t));
+      rbtree_insert_hint(t, NULL, arr[i]);
+      m = 0;
+      for (node_t *p = rbtree_min(t); p != NULL && m < n; p = rbtree_next(t, p)) {
+        nodes[m++] = p;
+      }
+    }
+  }
+#ifndef RBTREE_TOPDOWN
+  rbtree *l, *r;
+  assert(rbtree_split(t, (key_t)(n / 8), &l, &r) == 0);
+  rbtree_insert_hint(l, NULL, (key_t)(n / 8) - 1);
+  rbtree_insert_hint(r, NULL, (key_t)n);
+  t = rbtree_join(l, NULL, r);
+#endif
+  rbtree_insert_hint(t, NULL, (key_t)n + 1);
+  rbtree_insert_hint(t, rbtree_min(t), -1);
+
+  const size_t total = rbtree_size(t);
+  key_t *res = calloc(total, sizeof(key_t));
+  rbtree_to_array(t, res, total);
+  for (size_t i = 1; i < total; i++) {
+    assert(res[i - 1] <= res[i]);
+  }
+  assert(res[0] == -1 && res[total - 1] == (key_t)n + 1);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  free(res);
+  free(nodes);
+  delete_rbtree(t);
+  free(arr);
+}
+
+// remove every element of keys[0, n) in [lo, hi), keeping the rest in order
+static size_t remove_range(key_t *keys, const size_t n, const key_t lo, const key_t hi) {
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (keys[i] < lo || keys[i] >= hi)
+      keys[m++] = keys[i];
+  }
+  return m;
+}
+
+// erase_key removes one key per call; erase_range drops [lo, hi) and keeps the tree valid
+void test_erase_range(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int arena = 0; arena < 3; arena++) {
+    rbtree *t = arena == 2 ? new_rbtree_cow() : arena ? new_rbtree_sized(n) : new_rbtree();
+    for (size_t i = 0; i < n; i++) {
+      arr[i] = rand() % (int)(n / 2);
+      rbtree_insert(t, arr[i]);
+    }
+    qsort(arr, n, sizeof(key_t), comp);
+    size_t m = n;
+
+    assert(rbtree_erase_key(t, -1) == 0);
+    assert(rbtree_erase_key(t, arr[m / 2]) == 1);
+    memmove(arr + m / 2, arr + m / 2 + 1, (m - m / 2 - 1) * sizeof(key_t));
+    m--;
+    assert(rbtree_erase_range(t, 10, 10) == 0 && rbtree_erase_range(t, 10, 5) == 0);
+
+    while (m > 0) {
+      const key_t lo = rand() % (int)(n / 2 + 20) - 10;
+      const key_t hi = lo + rand() % (int)(n / 8 + 1);
+      const size_t left = remove_range(arr, m, lo, hi);
+      assert(rbtree_erase_range(t, lo, hi) == m - left);
+      m = left;
+      if (t->cow == NULL) {
+        check_tree_keys(t, arr, 0, m);
+      } else {
+        key_t *res = calloc(m + 1, sizeof(key_t));
+        assert(rbtree_size(t) == m);
+        rbtree_to_array(t, res, m);
+        assert(memcmp(res, arr, m * sizeof(key_t)) == 0);
+        free(res);
+      }
+      if (m < n / 4) {
+        assert(rbtree_erase_range(t, INT_MIN, INT_MAX) == m);
+        m = 0;
+      }
+    }
+    assert(rbtree_size(t) == 0 && rbtree_min(t) == NULL);
+    // the emptied tree is reusable
+    rbtree_insert(t, 3);
+    rbtree_insert_hint(t, NULL, 4);
+    assert(rbtree_erase_key(t, 3) == 1 && rbtree_size(t) == 1);
+    delete_rbtree(t);
+  }
+  free(arr);
+}
+
+static int comp_ptr(const void *p1, const void *p2) {
+  const uintptr_t e1 = (uintptr_t)*(node_t *const *)p1;
+  const uintptr_t e2 = (uintptr_t)*(node_t *const *)p2;
+  return (e1 > e2) - (e1 < e2);
+}
+
+// erasing a node (even one of many equal keys) leaves every other node in the tree with its key
+void test_erase_keeps_nodes(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  node_t **seen = calloc(n, sizeof(node_t *));
+  key_t *keys = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) {
+#ifdef RBTREE_COUNTED
+    keys[i] = (key_t)(i * 7 % n);  // equal keys would share a node here
+#else
+    keys[i] = rand() % (int)(n / 8);
+#endif
+    nodes[i] = rbtree_insert(t, keys[i]);
+  }
+
+  for (size_t m = n; m > 0;) {
+    const size_t i = rand() % m;
+    rbtree_erase(t, nodes[i]);
+    m--;
+    nodes[i] = nodes[m];
+    keys[i] = keys[m];
+    if (m % 97 == 0) {
+      assert(rbtree_size(t) == m);
+      rbtree_iter it;
+      rbtree_iter_init(&it, t);
+      size_t k = 0;
+      for (node_t *p = rbtree_iter_next(&it); p != NULL; p = rbtree_iter_next(&it)) {
+        seen[k++] = p;
+      }
+      assert(k == m);
+      for (size_t j = 0; j < m; j++) {
+        assert(nodes[j]->key == keys[j]);
+      }
+      qsort(seen, m, sizeof(node_t *), comp_ptr);
+      node_t **live = calloc(m + 1, sizeof(node_t *));
+      memcpy(live, nodes, m * sizeof(node_t *));
+      qsort(live, m, sizeof(node_t *), comp_ptr);
+      assert(memcmp(live, seen, m * sizeof(node_t *)) == 0);
+      free(live);
+      test_color_constraint(t);
+      test_search_constraint(t);
+    }
+  }
+  assert(rbtree_min(t) == NULL);
+  free(keys);
+  free(seen);
+  free(nodes);
+  delete_rbtree(t);
+}
+
+// long runs of equal keys can be walked and erased node by node, whether built by insert or from_sorted
+void test_equal_runs(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *sorted = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) {
+    sorted[i] = (key_t)(i * 4 / n);  // four runs of n / 4 equal keys
+  }
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (int build = 0; build < 2; build++) {
+    rbtree *t = build ? rbtree_from_sorted(sorted, n) : new_rbtree();
+    if (!build) {
+      for (size_t i = 0; i < n; i++) {
+        rbtree_insert(t, sorted[(i * 7919) % n]);
+      }
+    }
+    check_tree_keys(t, sorted, 0, n);
+
+    size_t cnt = 0, total = 0;
+    for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+      nodes[cnt++] = p;
+      total += rbtree_copies(p);
+    }
+    assert(total == n);
+    size_t m = cnt;
+    for (node_t *p = rbtree_max(t); p != NULL; p = rbtree_prev(t, p)) {
+      assert(nodes[--m] == p);
+    }
+    assert(m == 0);
+
+    // erase the nodes in random order, one copy at a time
+    for (m = 0; m < cnt; m++) {
+      const size_t k = m + rand() % (cnt - m);
+      node_t *p = nodes[k];
+      nodes[k] = nodes[m];
+      for (size_t c = rbtree_copies(p); c > 0; c--) {
+        assert(rbtree_erase(t, p) == 0);
+        total--;
+      }
+      assert(rbtree_size(t) == total);
+    }
+    assert(total == 0 && rbtree_min(t) == NULL);
+    delete_rbtree(t);
+  }
+  free(nodes);
+  free(sorted);
+}
+
+// insert_unique adds each key once; RBTREE_COUNTED builds also fold duplicates into one node
+void test_duplicates(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 10);
+  }
+  key_t *sorted = calloc(n, sizeof(key_t));
+  memcpy(sorted, arr, n * sizeof(key_t));
+  qsort(sorted, n, sizeof(key_t), comp);
+  size_t distinct = 0;
+  for (int i = 0; i < n; i++) {
+    distinct += i == 0 || sorted[i] != sorted[i - 1];
+  }
+
+  rbtree *u = new_rbtree();
+  size_t added = 0;
+  for (int i = 0; i < n; i++) {
+    int inserted;
+    node_t *p = rbtree_insert_unique(u, arr[i], &inserted);
+    assert(p != NULL && p->key == arr[i]);
+    assert(inserted || p == rbtree_find(u, arr[i]));
+    added += inserted;
+  }
+  assert(added == distinct && rbtree_size(u) == distinct);
+  assert(rbtree_insert_unique(u, arr[0], NULL) == rbtree_find(u, arr[0]));
+  assert(rbtree_size(u) == distinct);
+  test_color_constraint(u);
+  test_size_constraint(u);
+
+  rbtree *t = new_rbtree();
+  insert_arr(t, arr, n);
+  check_tree_keys(t, sorted, 0, n);
+  for (size_t k = 0; k < n; k += n / 7) {
+    assert(rbtree_select(t, k)->key == sorted[k]);
+    size_t below = 0;
+    while (sorted[below] < sorted[k]) {
+      below++;
+    }
+    assert(rbtree_rank(t, sorted[k]) == below);
+    assert(rbtree_range_count(t, sorted[k], sorted[k] + 1) == rbtree_range_count(t, 0, sorted[k] + 1) - below);
+  }
+
+  rbtree *f = rbtree_from_sorted(sorted, n);
+  check_tree_keys(f, sorted, 0, n);
+#ifdef RBTREE_COUNTED
+  // one node per distinct key, holding the number of copies
+  size_t nodes = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    assert(rbtree_copies(p) == rbtree_range_count(t, p->key, p->key + 1));
+    nodes++;
+  }
+  assert(nodes == distinct);
+  assert(rbtree_memory_usage(t) == rbtree_memory_usage(u));
+  nodes = 0;
+  for (node_t *p = rbtree_min(f); p != NULL; p = rbtree_next(f, p)) {
+    nodes++;
+  }
+  assert(nodes == distinct);
+
+  // erase drops one copy and keeps the node until the last one
+  node_t *p = rbtree_find(t, sorted[n / 2]);
+  const size_t copies = rbtree_copies(p);
+  while (rbtree_copies(p) > 1) {
+    rbtree_erase(t, p);
+    assert(rbtree_find(t, sorted[n / 2]) == p);
+  }
+  assert(rbtree_size(t) == n - copies + 1);
+  for (size_t i = 1; i < copies; i++) {
+    rbtree_insert(t, sorted[n / 2]);
+  }
+  check_tree_keys(t, sorted, 0, n);
+#endif
+
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_erase(t, rbtree_find(t, arr[i])) == 0);
+  }
+  assert(rbtree_size(t) == 0 && rbtree_min(t) == NULL);
+
+  free(arr);
+  free(sorted);
+  delete_rbtree(u);
+  delete_rbtree(t);
+  delete_rbtree(f);
+}
+
+#ifndef RBTREE_TOPDOWN
+// split at various keys and join back, keeping every node in place
+void test_split_join(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *keys = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    keys[i] = rand() % (n / 3);
+  }
+
+  for (int sized = 0; sized < 2; sized++) {
+    rbtree *t = sized ? new_rbtree_sized(n) : new_rbtree();
+    insert_arr(t, keys, n);
+    node_t *mid = rbtree_find(t, keys[0]);
+    key_t *sorted = calloc(n, sizeof(key_t));
+    memcpy(sorted, keys, n * sizeof(key_t));
+    qsort(sorted, n, sizeof(key_t), comp);
+
+    const key_t cuts[] = {-1, 0, sorted[n / 4], sorted[n / 2], sorted[n - 1], sorted[n - 1] + 1};
+    for (int c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+      rbtree *l, *r;
+      assert(rbtree_split(t, cuts[c], &l, &r) == 0);
+      size_t m = 0;
+      while (m < n && sorted[m] < cuts[c]) {
+        m++;
+      }
+      check_tree_keys(l, sorted, 0, m);
+      check_tree_keys(r, sorted, m, n);
+
+      // alternate between an implicit pivot and the maximum of the left tree
+      node_t *pivot = c % 2 ? rbtree_max(l) : NULL;
+      t = rbtree_join(l, pivot, r);
+      assert(t == l);
+      check_tree_keys(t, sorted, 0, n);
+    }
+    assert(rbtree_find(t, keys[0]) != NULL);
+    node_t *p = rbtree_find(t, mid->key);
+    while (p != NULL && p != mid && p->key == mid->key) {
+      p = rbtree_next(t, p);
+    }
+    node_t *q = rbtree_find(t, mid->key);
+    while (q != NULL && q != mid && q->key == mid->key) {
+      q = rbtree_prev(t, q);
+    }
+    assert(p == mid || q == mid);
+
+    // halves of an arena tree stay usable after the other half is deleted
+    rbtree *l, *r;
+    assert(rbtree_split(t, sorted[n / 2], &l, &r) == 0);
+    delete_rbtree(l);
+    for (size_t i = n / 2; i < n; i++) {
+      assert(rbtree_find(r, sorted[i]) != NULL);
+    }
+    rbtree_insert(r, sorted[n - 1]);
+    delete_rbtree(r);
+    free(sorted);
+  }
+
+  // independent arena trees are merged, mismatched storage is refused
+  rbtree *a = new_rbtree_sized(16), *b = new_rbtree_sized(16), *c = new_rbtree();
+  for (int i = 0; i < 100; i++) {
+    rbtree_insert(a, i);
+    rbtree_insert(b, 100 + i);
+    rbtree_insert(c, 200 + i);
+  }
+  rbtree_erase(b, rbtree_find(b, 150));
+#ifndef RBTREE_INDEX32
+  // index mode always allocates from an arena
+  assert(rbtree_join(b, NULL, c) == NULL);
+#endif
+  assert(rbtree_join(a, rbtree_min(c), b) == NULL);
+  a = rbtree_join(a, NULL, b);
+  assert(a != NULL && rbtree_size(a) == 199);
+  test_color_constraint(a);
+  rbtree_insert(a, 150);
+  delete_rbtree(a);
+  delete_rbtree(c);
+  free(keys);
+}
+
+// union, intersection and difference follow multiset counts on every thread count
+void test_set_ops(const size_t n, const unsigned int seed) {
+  srand(seed);
+  const size_t na = n, nb = n / 3;
+  key_t *ka = calloc(na, sizeof(key_t)), *kb = calloc(nb, sizeof(key_t));
+  for (size_t i = 0; i < na; i++) {
+    ka[i] = rand() % (n / 2);
+  }
+  for (size_t i = 0; i < nb; i++) {
+    kb[i] = rand() % n;
+  }
+  key_t *sa = calloc(na, sizeof(key_t)), *sb = calloc(nb, sizeof(key_t));
+  memcpy(sa, ka, na * sizeof(key_t));
+  memcpy(sb, kb, nb * sizeof(key_t));
+  qsort(sa, na, sizeof(key_t), comp);
+  qsort(sb, nb, sizeof(key_t), comp);
+
+  // expected results by merging the sorted inputs
+  key_t *expected[3];
+  size_t counts[3] = {0, 0, 0};
+  for (int op = 0; op < 3; op++) {
+    expected[op] = calloc(na + nb, sizeof(key_t));
+  }
+  size_t i = 0, j = 0;
+  while (i < na || j < nb) {
+    if (j == nb || (i < na && sa[i] < sb[j])) {
+      expected[0][counts[0]++] = sa[i];
+      expected[2][counts[2]++] = sa[i++];
+    } else if (i == na || sb[j] < sa[i]) {
+      expected[0][counts[0]++] = sb[j++];
+    } else {
+      expected[0][counts[0]++] = sa[i];
+      expected[0][counts[0]++] = sb[j++];
+      expected[1][counts[1]++] = sa[i++];
+    }
+  }
+
+  const int threads[] = {1, 4};
+  for (int th = 0; th < 2; th++) {
+    for (int sized = 0; sized < 2; sized++) {
+      for (int op = 0; op < 3; op++) {
+        rbtree *a = sized ? new_rbtree_sized(na) : new_rbtree();
+        rbtree *b = sized ? new_rbtree_sized(nb) : new_rbtree();
+        insert_arr(a, ka, na);
+        insert_arr(b, kb, nb);
+        node_t *kept = rbtree_find(a, sa[na / 2]);
+        rbtree *r = op == 0   ? rbtree_union(a, b, threads[th])
+                    : op == 1 ? rbtree_intersect(a, b, threads[th])
+                              : rbtree_difference(a, b, threads[th]);
+        assert(r == a);
+        check_tree_keys(r, expected[op], 0, counts[op]);
+        if (op == 0) {
+          // nodes are relinked, not copied
+          node_t *p = rbtree_find(r, kept->key);
+          while (p != kept && p != NULL && p->key == kept->key) {
+            p = rbtree_next(r, p);
+          }
+          assert(p == kept);
+        }
+        rbtree_insert(r, -1);
+        delete_rbtree(r);
+      }
+    }
+  }
+
+  // empty operands and mismatched storage
+  rbtree *a = new_rbtree(), *b = new_rbtree(), *c = new_rbtree_sized(4);
+  insert_arr(a, ka, 100);
+  a = rbtree_difference(a, b, 2);
+  assert(rbtree_size(a) == 100);
+  b = new_rbtree();
+  a = rbtree_intersect(a, b, 2);
+  assert(rbtree_size(a) == 0 && a->root == a->nil);
+#ifndef RBTREE_INDEX32
+  assert(rbtree_union(a, c, 2) == NULL);
+#endif
+  assert(rbtree_union(a, a, 2) == NULL);
+  delete_rbtree(a);
+  delete_rbtree(c);
+
+  for (int op = 0; op < 3; op++) {
+    free(expected[op]);
+  }
+  free(ka);
+  free(kb);
+  free(sa);
+  free(sb);
+}
+#endif
+
+// saved trees load back unchanged, and damaged files are refused
+void test_save_load(const size_t n, const unsigned int seed) {
+  srand(seed);
+  char path[] = "/tmp/test-rbtree-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  key_t *arr = calloc(n, sizeof(key_t));
+  rbtree *t = new_rbtree();
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % n - (int)(n / 2);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+  assert(rbtree_save(t, path) == 0);
+
+  rbtree *l = rbtree_load(path);
+  assert(l != NULL);
+  check_tree_keys(l, arr, 0, n);
+  delete_rbtree(l);
+
+  rbtree_mapped *m = rbtree_mapped_open(path);
+  assert(m != NULL && rbtree_mapped_size(m) == n);
+  key_t k;
+  assert(rbtree_mapped_min(m, &k) && k == arr[0]);
+  assert(rbtree_mapped_max(m, &k) && k == arr[n - 1]);
+  for (key_t key = arr[0] - 2; key <= arr[n - 1] + 2; key++) {
+    assert(rbtree_mapped_find(m, key) == (rbtree_find(t, key) != NULL));
+  }
+  rbtree_mapped_close(m);
+
+  // copy-on-write trees are saved through the stack iterator
+  rbtree *c = new_rbtree_cow();
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(c, arr[i]);
+  }
+  assert(rbtree_save(c, path) == 0);
+  l = rbtree_load(path);
+  check_tree_keys(l, arr, 0, n);
+  delete_rbtree(l);
+  delete_rbtree(c);
+
+  // a flipped key byte fails the checksum, a short file fails the size check
+  FILE *f = fopen(path, "r+b");
+  fseek(f, 32 + n * sizeof(key_t) / 2, SEEK_SET);
+  fputc(0x5a, f);
+  fclose(f);
+  assert(rbtree_load(path) == NULL);
+  assert(rbtree_mapped_open(path) == NULL);
+  assert(rbtree_save(t, path) == 0);
+  assert(truncate(path, 32 + (n - 1) * sizeof(key_t)) == 0);
+  assert(rbtree_load(path) == NULL);
+
+  rbtree *e = new_rbtree();
+  assert(rbtree_save(e, path) == 0);
+  l = rbtree_load(path);
+  assert(l != NULL && rbtree_size(l) == 0);
+  m = rbtree_mapped_open(path);
+  assert(m != NULL && !rbtree_mapped_min(m, &k) && !rbtree_mapped_find(m, 0));
+  rbtree_mapped_close(m);
+  delete_rbtree(l);
+  delete_rbtree(e);
+
+  assert(rbtree_load("/nonexistent/rbtree") == NULL);
+  assert(rbtree_save(t, "/nonexistent/rbtree") == -1);
+  remove(path);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// frozen arrays answer like the tree they came from, on both search paths
+static void check_frozen(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  rbtree *t = new_rbtree();
+  rbtree *ref = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = (key_t)(rand() % (2 * n + 1)) - (key_t)n;
+    if (i == 1)
+      arr[i] = INT_MAX;
+    if (i == 2)
+      arr[i] = INT_MIN;
+    rbtree_insert(t, arr[i]);
+    rbtree_insert(ref, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  rbtree_frozen *f = rbtree_freeze(t);
+  assert(f != NULL && rbtree_frozen_size(f) == n);
+  key_t k;
+  assert(rbtree_frozen_min(f, &k) == (n > 0) && (n == 0 || k == arr[0]));
+  assert(rbtree_frozen_max(f, &k) == (n > 0) && (n == 0 || k == arr[n - 1]));
+  for (key_t key = -(key_t)n - 2; key <= (key_t)n + 2; key++) {
+    const node_t *lb = rbtree_lower_bound(ref, key);
+    assert(rbtree_frozen_find(f, key) == (rbtree_find(ref, key) != NULL));
+    assert(rbtree_frozen_lower_bound(f, key, &k) == (lb != NULL));
+    assert(lb == NULL || k == lb->key);
+  }
+  assert(rbtree_frozen_find(f, INT_MAX) == (n > 1));
+  assert(rbtree_frozen_find(f, INT_MIN) == (n > 2));
+  assert(rbtree_frozen_lower_bound(f, INT_MAX - 1, &k) == (n > 1));
+
+  rbtree *back = rbtree_thaw(f);
+  assert(back != NULL);
+  check_tree_keys(back, arr, 0, n);
+  delete_rbtree(back);
+  delete_rbtree(ref);
+  free(arr);
+}
+
+void test_freeze(void) {
+  // sizes around the 8-key block and its 9-way fan-out
+  const size_t sizes[] = {0, 1, 2, 3, 7, 8, 9, 71, 72, 73, 80, 81, 648, 649, 5000};
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1)
+      setenv("RBTREE_NO_AVX2", "1", 1);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      check_frozen(sizes[i], 73 + i);
+    }
+  }
+  unsetenv("RBTREE_NO_AVX2");
+
+  // map trees cannot be rebuilt from keys alone and are left untouched
+  rbtree *m = new_rbtree_map(sizeof(int), 0);
+  const int v = 1;
+  rbtree_map_insert(m, 5, &v);
+  assert(rbtree_freeze(m) == NULL && rbtree_size(m) == 1);
+  delete_rbtree(m);
+
+  // copy-on-write trees freeze through their snapshot-safe array walk
+  rbtree *c = new_rbtree_cow();
+  for (int i = 0; i < 100; i++) {
+    rbtree_insert(c, i % 50);
+  }
+  rbtree_frozen *f = rbtree_freeze(c);
+  assert(f != NULL && rbtree_frozen_size(f) == 100);
+  assert(rbtree_frozen_find(f, 49) && !rbtree_frozen_find(f, 50));
+  delete_rbtree_frozen(f);
+}
+
+// readers never block or retry while a writer keeps inserting and erasing
+#define COW_READERS 4
+
+typedef struct {
+  rbtree *t;
+  int n;
+  volatile int *stop;
+} cow_arg;
+
+static void *cow_reader(void *p) {
+  cow_arg *a = p;
+  const int slot = rbtree_cow_reader_add(a->t);
+  assert(slot >= 0);
+  unsigned int seed = 11;
+  while (!*a->stop) {
+    rbtree_cow_read_lock(a->t, slot);
+    const key_t k = 4 * (rand_r(&seed) % a->n);
+    node_t *p = rbtree_find(a->t, k);
+    assert(p != NULL && p->key == k);
+    assert(rbtree_find(a->t, k + 2) == NULL);
+    assert(rbtree_min(a->t)->key == 0);
+    rbtree_cow_read_unlock(a->t, slot);
+  }
+  rbtree_cow_reader_remove(a->t, slot);
+  return NULL;
+}
+
+void test_cow_concurrent(const int n, const int rounds) {
+  rbtree *t = new_rbtree_cow();
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, 4 * i);
+  }
+
+  volatile int stop = 0;
+  cow_arg arg = {t, n, &stop};
+  pthread_t readers[COW_READERS];
+  for (int i = 0; i < COW_READERS; i++) {
+    pthread_create(&readers[i], NULL, cow_reader, &arg);
+  }
+  srand(47);
+  for (int r = 0; r < rounds; r++) {
+    const key_t k = 4 * (rand() % n) + 1;
+    node_t *p = rbtree_find(t, k);
+    if (p != NULL) {
+      assert(rbtree_erase(t, p) == 0);
+    } else {
+      assert(rbtree_insert(t, k) != NULL);
+    }
+  }
+  stop = 1;
+  for (int i = 0; i < COW_READERS; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  delete_rbtree(t);
+}
+
+// writers racing on the same keys through insert_unique add each key exactly once
+typedef struct {
+  rbtree *t;
+  int n;
+  int first;
+  size_t added;
+} cow_unique_arg;
+
+static void *cow_unique_writer(void *p) {
+  cow_unique_arg *a = p;
+  for (int i = 0; i < a->n; i++) {
+    int inserted;
+    const key_t k = (a->first + i) % a->n;
+    // another writer may already have replaced the returned node, so only its presence is checked
+    assert(rbtree_insert_unique(a->t, k, &inserted) != NULL);
+    a->added += inserted;
+  }
+  return NULL;
+}
+
+void test_cow_unique_concurrent(const int n) {
+  rbtree *t = new_rbtree_cow();
+  cow_unique_arg args[COW_READERS];
+  pthread_t writers[COW_READERS];
+  for (int i = 0; i < COW_READERS; i++) {
+    args[i] = (cow_unique_arg){t, n, i * n / (2 * COW_READERS), 0};
+    pthread_create(&writers[i], NULL, cow_unique_writer, &args[i]);
+  }
+  size_t added = 0;
+  for (int i = 0; i < COW_READERS; i++) {
+    pthread_join(writers[i], NULL);
+    added += args[i].added;
+  }
+  assert(added == n && rbtree_size(t) == n);
+  rbtree_iter it;
+  rbtree_iter_init(&it, t);
+  for (node_t *x = rbtree_iter_next(&it); x != NULL; x = rbtree_iter_next(&it)) {
+    assert(rbtree_copies(x) == 1);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+  test_size_constraint(t);
+  delete_rbtree(t);
+}
+
+#ifdef RBTREE_STATS
+// counters should reflect the work done and go back to zero on reset
+void test_stats(const size_t n) {
+  rbtree *t = new_rbtree();
+  rbtree_stats st;
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, i);
+  }
+  rbtree_stats_get(t, &st);
+  assert(st.allocs == n);
+  assert(st.rotations > 0 && st.rotations < n);
+  assert(st.insert_fixups > 0 && st.recolors > 0);
+  assert(st.comparisons > 0);
+
+  size_t descents = 0;
+  for (int d = 0; d < RBTREE_STATS_DEPTHS; d++) {
+    descents += st.depth_hist[d];
+  }
+  assert(descents == n);
+
+  rbtree_stats_reset(t);
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_find(t, i) != NULL);
+  }
+  rbtree_stats_get(t, &st);
+  assert(st.rotations == 0 && st.allocs == 0);
+  size_t depth_sum = 0;
+  descents = 0;
+  for (int d = 0; d < RBTREE_STATS_DEPTHS; d++) {
+    descents += st.depth_hist[d];
+    depth_sum += d * st.depth_hist[d];
+  }
+  assert(descents == n);
+  assert(depth_sum == st.comparisons);
+
+  for (int i = 0; i < n; i++) {
+    rbtree_erase(t, rbtree_find(t, i));
+  }
+  rbtree_stats_get(t, &st);
+  assert(st.frees == n);
+  assert(st.erase_fixups > 0);
+  delete_rbtree(t);
+}
+#endif
+
+int main(void) {
+  test_init();
+  test_insert_single(1024);
+  test_find_single(512, 1024);
+  test_erase_root(128);
+  test_find_erase_fixed();
+  test_minmax_suite();
+  test_to_array_suite();
+  test_distinct_values();
+  test_duplicate_values();
+  test_multi_instance();
+  test_find_erase_rand(10000, 17);
+  test_sized_tree(10000, 23);
+  test_next_prev();
+  test_find_batch(5000, 79);
+  test_to_array_bounded();
+  test_to_array_chunks();
+  test_from_sorted(130);
+  test_apply_batch(5000, 29);
+  test_order_statistic(3000, 31);
+  test_range(2000, 37);
+  test_template_i64(4000, 41);
+  test_template_other_keys();
+  test_map(1000);
+  test_memory_usage(5000);
+#if !defined(RBTREE_INDEX32) && !defined(RBTREE_TOPDOWN)
+  test_intrusive(1000);
+#endif
+  test_sync(2000, 200000);
+  test_sharded(40000, 16);
+  test_sharded_dups(20000);
+  test_cow_basic(3000, 53);
+  test_cow_snapshot(1000);
+  test_cow_concurrent(2000, 100000);
+  test_cow_unique_concurrent(20000);
+  test_snapshot(1000);
+#ifndef RBTREE_TOPDOWN
+  test_split_join(3000, 59);
+#endif
+  test_duplicates(3000, 67);
+  test_insert_hint(4000, 83);
+  test_erase_range(4000, 89);
+  test_erase_keeps_nodes(3000, 97);
+  test_equal_runs(40000, 101);
+  test_save_load(5000, 71);
+  test_freeze();
+#ifndef RBTREE_TOPDOWN
+  test_set_ops(20000, 61);
+#endif
+#ifdef RBTREE_STATS
+  test_stats(1000);
+#endif
   printf("Passed all tests!\n");
 }